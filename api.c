@@ -0,0 +1,227 @@
+#include "minall.h"
+#include "libminall.h"
+
+// The embedding API (libminall.h) on top of isolates
+//
+// A MinallRuntime is an isolate plus the natives registered through the
+// API. Every entry point enters the runtime's isolate for the length of
+// the call and puts back whichever one the thread was in before, so an
+// embedder can drive any number of runtimes from one thread.
+//
+// minall_compile() runs the front end and the bytecode compiler once and
+// keeps the program in the compile arena, which lives as long as the
+// runtime. Script parameters are resolved as the globals of an empty
+// prelude program: they get the first global slots, and the optimizer
+// treats them as written from outside, so it never folds them. vm_execute
+// seeds those slots from the run's arguments.
+//
+// minall_run() empties the value arena before each run (minall_reset_values)
+// and leaves the compile arena alone, so repeated runs of a script take no
+// more memory than one.
+//
+// Natives and print are linked to call sites by atom in resolve_program,
+// like every other call; nothing compares names while a script runs.
+
+#define NATIVE_ARGS_INLINE 16   // arguments converted without a malloc
+
+typedef struct ApiNative {
+    struct ApiNative* next;
+    MinallRuntime* runtime;
+    MinallNativeFunction function;
+    void* data;
+} ApiNative;
+
+struct MinallRuntime {
+    MinallIsolate* isolate;
+    ApiNative* natives;         // the data of the isolate's natives
+};
+
+struct MinallScript {
+    BytecodeProgram* program;
+    int param_count;
+};
+
+static MinallIsolate* api_enter(MinallRuntime* runtime) {
+    MinallIsolate* previous = minall_current;
+    minall_isolate_enter(runtime->isolate);
+    return previous;
+}
+
+static void api_leave(MinallIsolate* previous) {
+    minall_isolate_enter(previous);
+}
+
+static Value to_value(const MinallValue* value) {
+    switch (value->type) {
+        case MINALL_NUMBER:
+            return value_number(value->number);
+        case MINALL_STRING:
+            return value_string(string_from_chars(value->chars, (uint32_t)value->length));
+        default:
+            return value_undefined();
+    }
+}
+
+// Flattens ropes into the value arena; the characters stay put until the
+// arena is next emptied or collected
+static MinallValue from_value(Value value) {
+    if (value_is_number(value)) {
+        return minall_number(value_as_number(value));
+    }
+    if (value_is_string(value)) {
+        String* string = value_as_string(value);
+        return minall_string(string_chars(string), string->length);
+    }
+    return minall_undefined();
+}
+
+// The NativeFunction behind every API native: converts the arguments, calls
+// the embedder and converts the result back
+static Value call_api_native(Value* args, int arg_count, void* data) {
+    ApiNative* native = (ApiNative*)data;
+    MinallValue inline_args[NATIVE_ARGS_INLINE] = { { MINALL_UNDEFINED, 0, NULL, 0 } };
+    MinallValue* converted = inline_args;
+    if (arg_count > NATIVE_ARGS_INLINE) {
+        converted = (MinallValue*)malloc(arg_count * sizeof(MinallValue));
+        if (!converted) {
+            fprintf(stderr, "Error: Out of memory calling a native\n");
+            return value_undefined();
+        }
+    }
+    for (int i = 0; i < arg_count; i++) {
+        converted[i] = from_value(args[i]);
+    }
+
+    // The native may run code on another runtime in the meantime
+    MinallIsolate* isolate = minall_current;
+    MinallValue result = native->function(native->runtime, converted, arg_count, native->data);
+    minall_isolate_enter(isolate);
+
+    if (converted != inline_args) {
+        free(converted);
+    }
+    return to_value(&result);
+}
+
+MinallRuntime* minall_runtime_new(size_t memory_limit) {
+    MinallRuntime* runtime = (MinallRuntime*)calloc(1, sizeof(MinallRuntime));
+    if (!runtime) return NULL;
+    runtime->isolate = minall_isolate_new(memory_limit ? memory_limit : MEMORY_LIMIT_DEFAULT, false);
+    if (!runtime->isolate) {
+        free(runtime);
+        return NULL;
+    }
+
+    MinallIsolate* previous = api_enter(runtime);
+    minall_reset();
+    api_leave(previous);
+    return runtime;
+}
+
+void minall_runtime_free(MinallRuntime* runtime) {
+    if (!runtime) return;
+    minall_isolate_free(runtime->isolate);
+    while (runtime->natives) {
+        ApiNative* next = runtime->natives->next;
+        free(runtime->natives);
+        runtime->natives = next;
+    }
+    free(runtime);
+}
+
+int minall_register_native(MinallRuntime* runtime, const char* name,
+                           MinallNativeFunction function, void* data) {
+    ApiNative* native = (ApiNative*)malloc(sizeof(ApiNative));
+    if (!native) return -1;
+    native->runtime = runtime;
+    native->function = function;
+    native->data = data;
+
+    MinallIsolate* previous = api_enter(runtime);
+    int index = minall_define_native(name, call_api_native, native);
+    api_leave(previous);
+    if (index < 0) {
+        free(native);
+        return -1;
+    }
+    // A replaced native's record stays on the list until the runtime goes
+    native->next = runtime->natives;
+    runtime->natives = native;
+    return 0;
+}
+
+MinallScript* minall_compile(MinallRuntime* runtime, const char* source,
+                             const char* const* params, int param_count) {
+    if (param_count < 0 || param_count > MAX_VARIABLES) {
+        fprintf(stderr, "Error: A script takes at most %d parameters\n", MAX_VARIABLES);
+        return NULL;
+    }
+    MinallIsolate* previous = api_enter(runtime);
+
+    // Atoms point into the source, so it must live as long as the program
+    size_t length = strlen(source);
+    char* chars = (char*)minall_malloc(length + 1);
+    memcpy(chars, source, length + 1);
+
+    ASTNode* prelude = (ASTNode*)minall_malloc(sizeof(ASTNode));
+    memset(prelude, 0, sizeof(ASTNode));
+    prelude->type = NODE_PROGRAM;
+    prelude->data.block.global_names = (Atom**)minall_malloc((param_count + 1) * sizeof(Atom*));
+    for (int i = 0; i < param_count; i++) {
+        Atom* name = atom_intern(params[i], (uint32_t)strlen(params[i]));
+        for (int j = 0; j < i; j++) {
+            if (prelude->data.block.global_names[j] == name) {
+                fprintf(stderr, "Error: Parameter %s is listed twice\n", params[i]);
+                api_leave(previous);
+                return NULL;
+            }
+        }
+        prelude->data.block.global_names[i] = name;
+    }
+    prelude->data.block.global_count = param_count;
+
+    ASTNode* ast = parse(chars);
+    if (!ast || !resolve_program_after(ast, prelude)) {
+        api_leave(previous);
+        return NULL;
+    }
+    optimize_program(ast);
+
+    MinallScript* script = (MinallScript*)minall_malloc(sizeof(MinallScript));
+    script->program = compile_program(ast);
+    script->param_count = param_count;
+
+    api_leave(previous);
+    return script;
+}
+
+MinallValue minall_run(MinallRuntime* runtime, MinallScript* script,
+                       const MinallValue* args, int arg_count) {
+    MinallIsolate* previous = api_enter(runtime);
+    minall_reset_values();
+
+    Value inline_values[NATIVE_ARGS_INLINE];
+    Value* values = inline_values;
+    if (arg_count > script->param_count) {
+        arg_count = script->param_count;
+    }
+    if (arg_count > NATIVE_ARGS_INLINE) {
+        values = (Value*)malloc(arg_count * sizeof(Value));
+        if (!values) {
+            fprintf(stderr, "Error: Out of memory running a script\n");
+            api_leave(previous);
+            return minall_undefined();
+        }
+    }
+    for (int i = 0; i < arg_count; i++) {
+        values[i] = to_value(&args[i]);
+    }
+
+    MinallValue result = from_value(vm_execute(script->program, values, arg_count));
+
+    if (values != inline_values) {
+        free(values);
+    }
+    api_leave(previous);
+    return result;
+}
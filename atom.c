@@ -0,0 +1,133 @@
+#include "minall.h"
+
+// Atom table - every distinct identifier and string literal is stored once,
+// with its hash computed up front, so names compare by pointer everywhere
+// after the lexer. Each isolate has its own table. Atoms live in the memory
+// pool and the table is dropped together with it by minall_reset().
+//
+// Atoms made by the lexer borrow their characters from the source buffer
+// instead of copying them, so the source must outlive the program; atom
+// chars are therefore not NUL-terminated.
+
+#define ATOM_INITIAL_CAPACITY 64
+
+static INLINE uint32_t atom_hash(const char* chars, uint32_t length) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void atom_table_grow(AtomTable* table) {
+    uint32_t capacity = table->capacity ? table->capacity * 2 : ATOM_INITIAL_CAPACITY;
+    Atom** slots = (Atom**)minall_malloc(capacity * sizeof(Atom*));
+    memset(slots, 0, capacity * sizeof(Atom*));
+
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        Atom* atom = table->slots[i];
+        if (!atom) continue;
+
+        uint32_t index = atom->hash & (capacity - 1);
+        while (slots[index]) {
+            index = (index + 1) & (capacity - 1);
+        }
+        slots[index] = atom;
+    }
+
+    table->slots = slots;
+    table->capacity = capacity;
+}
+
+// Returns the slot holding the atom for chars, or the empty slot where it
+// belongs
+static INLINE Atom** atom_lookup(AtomTable* table, const char* chars, uint32_t length, uint32_t hash) {
+    uint32_t index = hash & (table->capacity - 1);
+
+    for (;;) {
+        Atom** slot = &table->slots[index];
+        Atom* atom = *slot;
+        if (!atom || (atom->hash == hash && atom->length == length &&
+                      memcmp(atom->chars, chars, length) == 0)) {
+            return slot;
+        }
+        index = (index + 1) & (table->capacity - 1);
+    }
+}
+
+Atom* atom_find(const char* chars, uint32_t length) {
+    AtomTable* table = &minall_current->atoms;
+    if (!table->slots) return NULL;
+    return *atom_lookup(table, chars, length, atom_hash(chars, length));
+}
+
+static Atom* atom_insert(const char* chars, uint32_t length, bool borrow) {
+    AtomTable* table = &minall_current->atoms;
+    if ((table->count + 1) * 2 > table->capacity) {
+        atom_table_grow(table);
+    }
+
+    uint32_t hash = atom_hash(chars, length);
+    Atom** slot = atom_lookup(table, chars, length, hash);
+    if (*slot) return *slot;
+
+    Atom* atom;
+    if (borrow) {
+        atom = (Atom*)minall_malloc(sizeof(Atom));
+        atom->chars = chars;
+    } else {
+        atom = (Atom*)minall_malloc(sizeof(Atom) + length);
+        char* copy = (char*)(atom + 1);
+        memcpy(copy, chars, length);
+        atom->chars = copy;
+    }
+    atom->length = length;
+    atom->hash = hash;
+
+    *slot = atom;
+    table->count++;
+    return atom;
+}
+
+// Interns a copy of chars
+Atom* atom_intern(const char* chars, uint32_t length) {
+    return atom_insert(chars, length, false);
+}
+
+// Interns chars in place; they must stay valid and unchanged until
+// minall_reset()
+Atom* atom_intern_span(const char* chars, uint32_t length) {
+    return atom_insert(chars, length, true);
+}
+
+// Natives outlive the table, so their names go back in every new one
+static void intern_natives(void) {
+    MinallIsolate* isolate = minall_current;
+    for (int i = 0; i < isolate->native_count; i++) {
+        Native* native = &isolate->natives[i];
+        native->name = atom_intern(native->chars, native->length);
+    }
+}
+
+void atom_table_reset() {
+    AtomTable* table = &minall_current->atoms;
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+
+    // Names the runtime itself checks for
+    table->print = atom_intern("print", 5);
+    intern_natives();
+}
+
+// The table lives in the pool, so a heap snapshot only needs this
+void atom_table_state(AtomTable* state) {
+    *state = minall_current->atoms;
+}
+
+void atom_table_restore(const AtomTable* state) {
+    minall_current->atoms = *state;
+    intern_natives();
+}
@@ -1,34 +1,189 @@
+// clock_gettime and sysconf are not part of C99
+#define _POSIX_C_SOURCE 199309L
+#include <ctype.h>
+#include <unistd.h>
 #include "minall.h"
 
-double benchmark_execution(const char* source, int iterations) {
+// Front end for a benchmark program, as parse_script in main.c: NULL after
+// a syntax or resolve error, which has been reported
+static ASTNode* prepare_program(const char* source, bool optimize) {
+    ASTNode* ast = parse(source);
+    if (!ast || !resolve_program(ast)) return NULL;
+    if (optimize) {
+        optimize_program(ast);
+    }
+    return ast;
+}
+
+static const char* SKIPPED = "Skipped: the program does not compile\n\n";
+
+// Negative if source does not compile
+double benchmark_execution(const char* source, int iterations, bool optimize) {
     clock_t total_start = clock();
     
     for (int i = 0; i < iterations; i++) {
         minall_reset();
         
-        int token_count;
-        Token* tokens = tokenize(source, &token_count);
-        ASTNode* ast = parse(tokens, token_count);
+        ASTNode* ast = prepare_program(source, optimize);
+        if (!ast) return -1;
         
-        Context ctx;
-        init_context(&ctx);
-        interpret(ast, &ctx);
+        Context* ctx = &minall_current->context;
+        init_context(ctx);
+        interpret(ast, ctx);
     }
     
     clock_t total_end = clock();
     return ((double)(total_end - total_start)) / CLOCKS_PER_SEC;
 }
 
-void run_performance_tests() {
+// Tokenizes source repeatedly and returns throughput in MB/s
+static double benchmark_lexer(const char* source, int iterations) {
+    size_t length = strlen(source);
+    clock_t start = clock();
+    
+    for (int i = 0; i < iterations; i++) {
+        minall_reset();
+        Lexer lexer;
+        Token token;
+        lexer_init(&lexer, source);
+        do {
+            lexer_next(&lexer, &token);
+        } while (token.type != TOKEN_EOF);
+    }
+    
+    clock_t end = clock();
+    double seconds = ((double)(end - start)) / CLOCKS_PER_SEC;
+    return (double)length * iterations / (1024.0 * 1024.0) / seconds;
+}
+
+// The keyword test the lexer made before it classified in place: intern
+// the identifier, then strcmp it against each keyword in turn
+static TokenType strcmp_keyword_type(const char* start, int length) {
+    const char* word = atom_intern_span(start, (uint32_t)length)->chars;
+    if (strncmp(word, "var", length) == 0 && length == 3) return TOKEN_VAR;
+    if (strncmp(word, "function", length) == 0 && length == 8) return TOKEN_FUNCTION;
+    if (strncmp(word, "if", length) == 0 && length == 2) return TOKEN_IF;
+    if (strncmp(word, "else", length) == 0 && length == 4) return TOKEN_ELSE;
+    if (strncmp(word, "for", length) == 0 && length == 3) return TOKEN_FOR;
+    if (strncmp(word, "while", length) == 0 && length == 5) return TOKEN_WHILE;
+    if (strncmp(word, "return", length) == 0 && length == 6) return TOKEN_RETURN;
+    return TOKEN_IDENTIFIER;
+}
+
+// Classifies every word of source repeatedly, either the way the lexer does
+// now (interning only identifiers) or with strcmp_keyword_type, and returns
+// millions of words per second
+static double benchmark_keywords(const char* source, int iterations, bool use_strcmp) {
+    minall_reset();
+    int count = 0;
+    for (const char* p = source; *p; p++) {
+        count += (isalpha((unsigned char)*p) || *p == '_') &&
+                 (p == source || !(isalnum((unsigned char)p[-1]) || p[-1] == '_'));
+    }
+    const char** starts = (const char**)minall_malloc(count * sizeof(const char*));
+    int* lengths = (int*)minall_malloc(count * sizeof(int));
+    count = 0;
+    for (const char* p = source; *p; ) {
+        if (!isalpha((unsigned char)*p) && *p != '_') {
+            p++;
+            continue;
+        }
+        const char* start = p;
+        while (isalnum((unsigned char)*p) || *p == '_') p++;
+        starts[count] = start;
+        lengths[count++] = (int)(p - start);
+    }
+    
+    volatile int keywords = 0;
+    clock_t start = clock();
+    for (int i = 0; i < iterations; i++) {
+        int found = 0;
+        for (int j = 0; j < count; j++) {
+            if (use_strcmp) {
+                found += strcmp_keyword_type(starts[j], lengths[j]) != TOKEN_IDENTIFIER;
+            } else if (lexer_keyword_type(starts[j], lengths[j]) != TOKEN_IDENTIFIER) {
+                found++;
+            } else {
+                atom_intern_span(starts[j], (uint32_t)lengths[j]);
+            }
+        }
+        keywords = found;
+    }
+    clock_t end = clock();
+    (void)keywords;
+    
+    double seconds = ((double)(end - start)) / CLOCKS_PER_SEC;
+    return (double)count * iterations / 1e6 / seconds;
+}
+
+typedef Value (*VmEntry)(BytecodeProgram* program, Value* script_args, int script_arg_count);
+
+// Runs an already-parsed program repeatedly on the tree walker (vm NULL) or
+// on a build of the VM, so that front-end cost does not hide the difference
+// between the engines
+static double benchmark_engine(ASTNode* ast, int iterations, VmEntry vm) {
+    BytecodeProgram* program = vm ? compile_program(ast) : NULL;
+    clock_t start = clock();
+    
+    for (int i = 0; i < iterations; i++) {
+        if (vm) {
+            vm(program, NULL, 0);
+        } else {
+            Context* ctx = &minall_current->context;
+            init_context(ctx);
+            interpret(ast, ctx);
+        }
+    }
+    
+    clock_t end = clock();
+    return ((double)(end - start)) / CLOCKS_PER_SEC;
+}
+
+// Prints a benchmark_execution time, or that the test was skipped
+static void report_execution(const char* label, int iterations, double seconds) {
+    if (seconds < 0) {
+        printf("%s", SKIPPED);
+    } else {
+        printf("%s iterations: %.6f seconds (%.2f ops/sec)\n\n", label, seconds, iterations / seconds);
+    }
+}
+
+// One copy of a benchmark_execution workload, run by minall_run_jobs in
+// the worker's own isolate
+typedef struct {
+    const char* source;
+    int iterations;
+    bool optimize;
+} IsolateWorkload;
+
+static void benchmark_isolate_job(int index, void* data) {
+    IsolateWorkload* workload = (IsolateWorkload*)data;
+    (void)index;
+    benchmark_execution(workload->source, workload->iterations, workload->optimize);
+}
+
+// Wall-clock seconds to run copies of the workload on jobs threads
+static double benchmark_isolates(IsolateWorkload* workload, int copies, int jobs) {
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    minall_run_jobs(copies, jobs, benchmark_isolate_job, workload);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// jobs is the thread count for the isolate test, 0 for one per CPU
+void run_performance_tests(bool optimize, int jobs) {
     printf("MinAll Performance Benchmarks\n");
-    printf("==============================\n\n");
+    printf("==============================\n");
+    printf("AST optimizations: %s\n\n", optimize ? "on" : "off (--no-opt)");
     
     // Test 1: Simple arithmetic
     const char* test1 = "var x = 10; var y = 20; var z = x + y * 2;";
     printf("Test 1: Simple arithmetic\n");
     printf("Code: %s\n", test1);
-    double time1 = benchmark_execution(test1, 10000);
-    printf("10,000 iterations: %.6f seconds (%.2f ops/sec)\n\n", time1, 10000.0 / time1);
+    double time1 = benchmark_execution(test1, 10000, optimize);
+    report_execution("10,000", 10000, time1);
     
     // Test 2: Function calls
     const char* test2 = 
@@ -36,8 +191,8 @@ void run_performance_tests() {
         "var result = add(5, 10);";
     printf("Test 2: Function calls\n");
     printf("Code: %s\n", test2);
-    double time2 = benchmark_execution(test2, 5000);
-    printf("5,000 iterations: %.6f seconds (%.2f ops/sec)\n\n", time2, 5000.0 / time2);
+    double time2 = benchmark_execution(test2, 5000, optimize);
+    report_execution("5,000", 5000, time2);
     
     // Test 3: Loops and conditionals
     const char* test3 = 
@@ -49,8 +204,8 @@ void run_performance_tests() {
         "}";
     printf("Test 3: Loops and conditionals\n");
     printf("Code: %s\n", test3);
-    double time3 = benchmark_execution(test3, 1000);
-    printf("1,000 iterations: %.6f seconds (%.2f ops/sec)\n\n", time3, 1000.0 / time3);
+    double time3 = benchmark_execution(test3, 1000, optimize);
+    report_execution("1,000", 1000, time3);
     
     // Test 4: Recursive function
     const char* test4 = 
@@ -61,20 +216,165 @@ void run_performance_tests() {
         "var result = factorial(10);";
     printf("Test 4: Recursive function\n");
     printf("Code: %s\n", test4);
-    double time4 = benchmark_execution(test4, 1000);
-    printf("1,000 iterations: %.6f seconds (%.2f ops/sec)\n\n", time4, 1000.0 / time4);
+    double time4 = benchmark_execution(test4, 1000, optimize);
+    report_execution("1,000", 1000, time4);
     
+    // Test 5: Tree walker vs bytecode VM on the same parsed program
+    const char* test5 = 
+        "function fibonacci(n) {"
+        "  if (n <= 1) return n;"
+        "  return fibonacci(n - 1) + fibonacci(n - 2);"
+        "}"
+        "var i = 0; var acc = 0;"
+        "while (i < 2000) { acc = acc + i * i - i / 2 + i % 7; i = i + 1; }"
+        "var fib = fibonacci(10);";
+    printf("Test 5: Execution engines (parsed once)\n");
+    printf("Code: %s\n", test5);
+    minall_reset();
+    ASTNode* ast = prepare_program(test5, optimize);
+    if (ast) {
+        double tree_time = benchmark_engine(ast, 100, NULL);
+        double vm_time = benchmark_engine(ast, 100, vm_execute);
+        printf("100 iterations, tree walker: %.6f seconds\n", tree_time);
+#ifdef MINALL_THREADED_DISPATCH
+        // The same handlers built as a switch loop (vm_switch.c)
+        double switch_time = benchmark_engine(ast, 100, vm_execute_switch);
+        printf("100 iterations, VM (switch dispatch): %.6f seconds\n", switch_time);
+        printf("100 iterations, VM (computed goto dispatch): %.6f seconds\n", vm_time);
+        printf("Computed goto speedup over switch: %.2fx\n", switch_time / vm_time);
+#else
+        printf("100 iterations, VM (switch dispatch): %.6f seconds\n", vm_time);
+#endif
+        printf("VM speedup: %.2fx\n\n", tree_time / vm_time);
+    } else {
+        printf("%s", SKIPPED);
+    }
+    
+    // Test 6: Lexer throughput on keyword-heavy source
+    static char test6[32 * 1024];
+    const char* snippet =
+        "function count(limit) { var total = 0; var i = 0;"
+        " while (i < limit) { if (i % 3 == 0) { total = total + i; }"
+        " else { total = total - 1; } i = i + 1; } return total; }\n";
+    size_t snippet_length = strlen(snippet);
+    size_t test6_length = 0;
+    while (test6_length + snippet_length < sizeof(test6)) {
+        memcpy(test6 + test6_length, snippet, snippet_length);
+        test6_length += snippet_length;
+    }
+    test6[test6_length] = '\0';
+    printf("Test 6: Lexer throughput\n");
+    printf("Code: %zu bytes of repeated function declarations\n", test6_length);
+    double lexer_mbps = benchmark_lexer(test6, 500);
+#if defined(MINALL_LEXER_AVX2)
+    const char* scanner = "AVX2";
+#elif defined(MINALL_LEXER_SSE2)
+    const char* scanner = "SSE2";
+#else
+    const char* scanner = "scalar";
+#endif
+    printf("500 iterations, lexer (%s scanner): %.2f MB/s\n", scanner, lexer_mbps);
+    // Keyword classification alone, against the strcmp chain it replaced
+    double switch_words = benchmark_keywords(test6, 500, false);
+    double strcmp_words = benchmark_keywords(test6, 500, true);
+    printf("500 iterations, keywords by in-place switch: %.2f M words/s\n", switch_words);
+    printf("500 iterations, keywords by intern + strcmp (baseline): %.2f M words/s\n", strcmp_words);
+    printf("Keyword speedup: %.2fx\n\n", switch_words / strcmp_words);
+    
+    // Test 7: Short-lived strings, reclaimed by the collector
+    const char* test7 =
+        "function label(n) { return \"item \" + n + \" of a list long enough for a rope\"; }"
+        "var i = 0; var last = \"\";"
+        "while (i < 5000) { last = label(i); i = i + 1; }";
+    printf("Test 7: String garbage\n");
+    printf("Code: %s\n", test7);
+    minall_reset();
+    ast = prepare_program(test7, optimize);
+    if (ast) {
+        double tree_gc_time = benchmark_engine(ast, 20, NULL);
+        double vm_gc_time = benchmark_engine(ast, 20, vm_execute);
+        printf("20 iterations, tree walker: %.6f seconds\n", tree_gc_time);
+        printf("20 iterations, VM: %.6f seconds\n\n", vm_gc_time);
+    } else {
+        printf("%s", SKIPPED);
+    }
+
+    // Test 8: Lexer throughput on a large generated script, with the
+    // indentation, comments and long names that generated code tends to have
+    const char* block =
+        "// Generated accessor for record field number, do not edit by hand\n"
+        "function generated_record_field_accessor(record_index, field_offset) {\n"
+        "    var qualified_field_name = \"generated_records.field_\" + field_offset;\n"
+        "    if (record_index >= 1000) {\n"
+        "        // Out of range records fall back to the default value\n"
+        "        return \"default value for an out of range record\";\n"
+        "    }\n"
+        "    return qualified_field_name + record_index * 4096;\n"
+        "}\n\n";
+    size_t block_length = strlen(block);
+    size_t test8_size = 4 * 1024 * 1024;
+    char* test8 = (char*)malloc(test8_size + 1);
+    size_t test8_length = 0;
+    while (test8_length + block_length < test8_size) {
+        memcpy(test8 + test8_length, block, block_length);
+        test8_length += block_length;
+    }
+    test8[test8_length] = '\0';
+    printf("Test 8: Lexer throughput on a large script (%s scanning)\n", scanner);
+    printf("Code: %zu bytes of generated functions\n", test8_length);
+    double large_mbps = benchmark_lexer(test8, 20);
+    printf("20 iterations: %.2f MB/s\n\n", large_mbps);
+    free(test8);
+
+    // Test 9: Copies of a workload in isolates, one thread each versus all
+    // on one thread; with nothing shared the speedup should track the
+    // number of cores
+    if (jobs <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (int)cpus : 1;
+    }
+    IsolateWorkload workload = { test4, 2000, optimize };
+    printf("Test 9: Isolates in parallel (%d jobs, %ld CPUs online)\n", jobs,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("Code: %d copies of Test 4, 2,000 iterations each\n", jobs);
+    double serial_time = benchmark_isolates(&workload, jobs, 1);
+    double parallel_time = benchmark_isolates(&workload, jobs, jobs);
+    printf("1 thread: %.6f seconds\n", serial_time);
+    printf("%d threads: %.6f seconds\n", jobs, parallel_time);
+    printf("Scaling: %.2fx\n\n", serial_time / parallel_time);
+
     // Memory usage statistics
     printf("Memory Statistics\n");
     printf("-----------------\n");
-    printf("Memory pool size: %d bytes\n", MEMORY_POOL_SIZE);
-    printf("Current memory usage: %zu bytes\n", memory_offset);
-    printf("Memory efficiency: %.2f%%\n", (double)memory_offset / MEMORY_POOL_SIZE * 100);
+    MemoryStats stats;
+    minall_memory_stats(&stats);
+    printf("Compile arena: %zu bytes used in %d chunks (%zu bytes mapped)\n",
+           stats.compile_used, stats.chunk_count, stats.compile_mapped);
+    printf("Memory efficiency: %.2f%%\n", (double)stats.compile_used / stats.compile_mapped * 100);
+    printf("Value arena: %zu bytes used (%zu bytes committed)\n",
+           stats.value_used, stats.value_committed);
+    printf("Peak memory usage: %zu of %zu bytes allowed\n", stats.peak, stats.limit);
+    GcStats gc;
+    gc_stats(&gc);
+    printf("Minor collections: %d (%.6f seconds)\n", gc.minor_count, gc.minor_seconds);
+    printf("Major collections: %d (%.6f seconds)\n", gc.major_count, gc.major_seconds);
+    printf("Longest GC pause: %.6f seconds\n", gc.max_pause);
+    printf("Reclaimed by GC: %zu bytes\n", gc.reclaimed);
     
     // Performance summary
     printf("\nPerformance Summary\n");
     printf("-------------------\n");
-    printf("Total benchmark time: %.6f seconds\n", time1 + time2 + time3 + time4);
-    printf("Average operations per second: %.2f\n", 
-           (10000 + 5000 + 1000 + 1000) / (time1 + time2 + time3 + time4));
+    // Over Tests 1-4, leaving out any that were skipped
+    double times[] = { time1, time2, time3, time4 };
+    int counts[] = { 10000, 5000, 1000, 1000 };
+    double total_time = 0;
+    int total_count = 0;
+    for (int i = 0; i < 4; i++) {
+        if (times[i] >= 0) {
+            total_time += times[i];
+            total_count += counts[i];
+        }
+    }
+    printf("Total benchmark time: %.6f seconds\n", total_time);
+    printf("Average operations per second: %.2f\n", total_count / total_time);
 }
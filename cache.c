@@ -0,0 +1,498 @@
+// mmap, fstat, getpid, gettid and rename's POSIX behaviour are not part of C99
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "minall.h"
+
+// Compiled script cache
+//
+// A cache file holds one compiled BytecodeProgram, keyed by a hash of the
+// script's source, its length, whether AST optimizations ran, and the
+// runtime version and instruction set: BYTECODE_VERSION and a hash of the
+// opcode names in order, so a build that renumbers or redefines opcodes
+// never runs another build's files. Instructions only refer to constants,
+// globals and functions by index, so the code arrays are written exactly as
+// they are in memory and run straight from a read-only mapping of the
+// file: loading is one mmap plus one small allocation per function and
+// string constant, with no fixups in the code.
+//
+// The VM trusts its code, so a loaded file is checked first: cache_verify
+// checks each function's operands, then follows its control flow to check
+// the operand stack depth on every path, and rejects anything the compiler
+// could not have written; the script is compiled again instead.
+//
+// Layout, every section 8-byte aligned and addressed by its file offset:
+//
+//   CacheHeader
+//   CacheFunction[function_count]
+//   CacheString[string_count]     string constants
+//   CacheString[global_count]     global names
+//   Instruction[]                 each function's code in turn
+//   characters                    names and constants, not NUL-terminated
+//
+// Files go to $MINALL_CACHE_DIR, named by the source hash, or otherwise
+// next to the script as <script>.mbc; --no-opt builds get their own file
+// (<hash>.noopt.mbc, <script>.noopt.mbc) so the two never evict each other.
+// They are written to a temporary file and renamed into place, so
+// concurrent runs of the same script never see a partial file.
+
+#define CACHE_MAGIC "MINALLBC"
+#define CACHE_FORMAT 2
+#define CACHE_OPTIMIZED 1
+
+typedef struct {
+    char magic[8];
+    uint32_t format;
+    uint32_t instruction_size;      // sizeof(Instruction)
+    uint32_t opcode_count;          // OP_HALT + 1
+    uint32_t flags;
+    char version[16];               // MINALL_VERSION
+    uint64_t bytecode;              // bytecode_signature()
+    uint64_t source_hash;
+    uint64_t source_length;
+    int32_t function_count;
+    int32_t string_count;
+    int32_t global_count;
+    int32_t padding;
+    uint64_t file_size;
+} CacheHeader;
+
+typedef struct {
+    uint64_t code;                  // offset of the Instruction array
+    uint64_t name;                  // offset of the name's characters
+    uint32_t name_length;
+    int32_t code_count;
+    int32_t param_count;
+    int32_t local_count;
+    int32_t max_stack;
+    int32_t padding;
+} CacheFunction;
+
+typedef struct {
+    uint64_t chars;
+    uint64_t length;
+} CacheString;
+
+static INLINE uint64_t cache_align(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+static INLINE uint64_t cache_mix(uint64_t hash, uint64_t word) {
+    hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+    return hash ^ (hash >> 32);
+}
+
+// Reads eight bytes per step; only has to tell scripts apart, not resist
+// deliberate collisions
+uint64_t cache_hash(const char* chars, size_t length) {
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, chars + i, 8);
+        hash = cache_mix(hash, word);
+    }
+    if (i < length) {
+        uint64_t word = 0;
+        memcpy(&word, chars + i, length - i);
+        hash = cache_mix(hash, word);
+    }
+    hash ^= hash >> 29;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    return hash ^ (hash >> 32);
+}
+
+// Returns a malloc'd path, or NULL when the script has nowhere to keep one
+// (stdin without a cache directory)
+char* cache_path(const char* script, uint64_t hash, bool optimized) {
+    const char* dir = getenv("MINALL_CACHE_DIR");
+    const char* suffix = optimized ? ".mbc" : ".noopt.mbc";
+    size_t size;
+    char* path;
+
+    if (dir && *dir) {
+        size = strlen(dir) + 32;
+        path = (char*)malloc(size);
+        if (path) {
+            snprintf(path, size, "%s/%016llx%s", dir, (unsigned long long)hash, suffix);
+        }
+        return path;
+    }
+    if (strcmp(script, "-") == 0) {
+        return NULL;
+    }
+    size = strlen(script) + 16;
+    path = (char*)malloc(size);
+    if (path) {
+        snprintf(path, size, "%s%s", script, suffix);
+    }
+    return path;
+}
+
+// Identifies the instruction set: its version and every opcode's name in
+// numbering order
+static uint64_t bytecode_signature(void) {
+    uint64_t signature = cache_mix(BYTECODE_VERSION, sizeof(Instruction));
+    for (int op = 0; op <= OP_HALT; op++) {
+        const char* name = opcode_name((OpCode)op);
+        signature = cache_mix(signature, cache_hash(name, strlen(name)));
+    }
+    return signature;
+}
+
+static void cache_header(CacheHeader* header, uint64_t hash, size_t source_length, bool optimized) {
+    memset(header, 0, sizeof(CacheHeader));
+    memcpy(header->magic, CACHE_MAGIC, 8);
+    header->format = CACHE_FORMAT;
+    header->instruction_size = sizeof(Instruction);
+    header->opcode_count = OP_HALT + 1;
+    header->flags = optimized ? CACHE_OPTIMIZED : 0;
+    strncpy(header->version, MINALL_VERSION, sizeof(header->version) - 1);
+    header->bytecode = bytecode_signature();
+    header->source_hash = hash;
+    header->source_length = source_length;
+}
+
+static bool cache_put(FILE* file, const void* data, size_t size, uint64_t* offset) {
+    static const char zeros[8];
+    size_t pad = (size_t)(cache_align(*offset) - *offset);
+    if (pad && fwrite(zeros, 1, pad, file) != pad) return false;
+    if (size && fwrite(data, 1, size, file) != size) return false;
+    *offset = cache_align(*offset) + size;
+    return true;
+}
+
+// Natives are numbered in the order an isolate registers them, so code
+// that calls one is only valid in that isolate
+static bool calls_natives(BytecodeProgram* program) {
+    for (int f = 0; f < program->function_count; f++) {
+        BytecodeFunction* function = &program->functions[f];
+        for (int i = 0; i < function->code_count; i++) {
+            if (function->code[i].op == OP_CALL_NATIVE) return true;
+        }
+    }
+    return false;
+}
+
+bool cache_write(const char* path, BytecodeProgram* program, uint64_t hash,
+                 size_t source_length, bool optimized) {
+    if (calls_natives(program)) return false;
+
+    int function_count = program->function_count;
+    int string_count = program->string_count;
+    int global_count = program->global_count;
+
+    CacheHeader header;
+    cache_header(&header, hash, source_length, optimized);
+    header.function_count = function_count;
+    header.string_count = string_count;
+    header.global_count = global_count;
+
+    // Tables are built in the compile arena with every offset filled in,
+    // then everything is written in one sequential pass
+    CacheFunction* functions = (CacheFunction*)minall_malloc((function_count + 1) * sizeof(CacheFunction));
+    CacheString* strings = (CacheString*)minall_malloc((string_count + 1) * sizeof(CacheString));
+    CacheString* globals = (CacheString*)minall_malloc((global_count + 1) * sizeof(CacheString));
+
+    uint64_t offset = cache_align(sizeof(CacheHeader));
+    offset = cache_align(offset + function_count * sizeof(CacheFunction));
+    offset = cache_align(offset + string_count * sizeof(CacheString));
+    offset = cache_align(offset + global_count * sizeof(CacheString));
+    for (int i = 0; i < function_count; i++) {
+        functions[i].code = offset;
+        offset = cache_align(offset + program->functions[i].code_count * sizeof(Instruction));
+    }
+    for (int i = 0; i < function_count; i++) {
+        BytecodeFunction* function = &program->functions[i];
+        functions[i].name = offset;
+        functions[i].name_length = function->name->length;
+        functions[i].code_count = function->code_count;
+        functions[i].param_count = function->param_count;
+        functions[i].local_count = function->local_count;
+        functions[i].max_stack = function->max_stack;
+        functions[i].padding = 0;
+        offset += function->name->length;
+    }
+    for (int i = 0; i < string_count; i++) {
+        strings[i].chars = offset;
+        strings[i].length = program->strings[i].length;
+        offset += program->strings[i].length;
+    }
+    for (int i = 0; i < global_count; i++) {
+        globals[i].chars = offset;
+        globals[i].length = program->global_names[i]->length;
+        offset += program->global_names[i]->length;
+    }
+    header.file_size = offset;
+
+    size_t temp_size = strlen(path) + 48;
+    char* temp = (char*)malloc(temp_size);
+    if (!temp) return false;
+    // Unique per thread, as --jobs may compile the same script twice at once
+    snprintf(temp, temp_size, "%s.%ld.%ld.tmp", path, (long)getpid(), (long)gettid());
+
+    FILE* file = fopen(temp, "wb");
+    if (!file) {
+        free(temp);
+        return false;
+    }
+
+    uint64_t written = 0;
+    bool ok = cache_put(file, &header, sizeof(CacheHeader), &written) &&
+              cache_put(file, functions, function_count * sizeof(CacheFunction), &written) &&
+              cache_put(file, strings, string_count * sizeof(CacheString), &written) &&
+              cache_put(file, globals, global_count * sizeof(CacheString), &written);
+    for (int i = 0; ok && i < function_count; i++) {
+        ok = cache_put(file, program->functions[i].code,
+                       program->functions[i].code_count * sizeof(Instruction), &written);
+    }
+    // Characters are packed, so written by hand after aligning once
+    ok = ok && cache_put(file, NULL, 0, &written);
+    for (int i = 0; ok && i < function_count; i++) {
+        Atom* name = program->functions[i].name;
+        ok = fwrite(name->chars, 1, name->length, file) == name->length;
+    }
+    for (int i = 0; ok && i < string_count; i++) {
+        String* string = &program->strings[i];
+        ok = fwrite(string_chars(string), 1, string->length, file) == string->length;
+    }
+    for (int i = 0; ok && i < global_count; i++) {
+        Atom* name = program->global_names[i];
+        ok = fwrite(name->chars, 1, name->length, file) == name->length;
+    }
+
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(temp, path) == 0;
+    if (!ok) {
+        remove(temp);
+    }
+    free(temp);
+    return ok;
+}
+
+static INLINE bool cache_span(const CacheHeader* header, uint64_t offset, uint64_t size) {
+    return offset <= header->file_size && size <= header->file_size - offset;
+}
+
+// Follows every path through a function's code from its first instruction,
+// recording the operand stack depth each instruction starts at. A path may
+// not underflow the stack, exceed max_stack, or run off the end of the code,
+// and every path into an instruction must arrive at the same depth, as the
+// compiler's statements always do, so no loop can grow the stack.
+static bool cache_verify_stack(const CacheFunction* function, const Instruction* code) {
+    int* depths = (int*)malloc(function->code_count * sizeof(int));
+    int* pending = (int*)malloc(function->code_count * sizeof(int));
+    bool ok = depths && pending;
+    int pending_count = 0;
+    if (ok) {
+        for (int i = 0; i < function->code_count; i++) {
+            depths[i] = -1;
+        }
+        depths[0] = 0;
+        pending[pending_count++] = 0;
+    }
+
+    while (ok && pending_count > 0) {
+        int i = pending[--pending_count];
+        const Instruction* instruction = &code[i];
+        int depth = depths[i];
+
+        // Arguments are on the stack before the call pushes its result
+        int arg_count = 0;
+        if (instruction->op == OP_CALL || instruction->op == OP_PRINT) {
+            arg_count = instruction->operand.call.arg_count;
+        }
+        depth += opcode_stack_effect(instruction->op);
+        ok = arg_count <= depths[i] && depth <= function->max_stack;
+        depth -= arg_count;
+        ok = ok && depth >= 0;
+
+        int successors[2];
+        int successor_count = 0;
+        switch (instruction->op) {
+            case OP_RETURN:
+            case OP_HALT:
+                break;
+            case OP_JUMP:
+                successors[successor_count++] = i + 1 + instruction->operand.jump_offset;
+                break;
+            case OP_JUMP_IF_FALSE:
+                successors[successor_count++] = i + 1 + instruction->operand.jump_offset;
+                successors[successor_count++] = i + 1;
+                break;
+            default:
+                successors[successor_count++] = i + 1;
+                break;
+        }
+        for (int j = 0; ok && j < successor_count; j++) {
+            int next = successors[j];
+            if (next >= function->code_count) {
+                ok = false;
+            } else if (depths[next] < 0) {
+                depths[next] = depth;
+                pending[pending_count++] = next;
+            } else {
+                ok = depths[next] == depth;
+            }
+        }
+    }
+
+    free(depths);
+    free(pending);
+    return ok;
+}
+
+// Checks a function's code: every opcode is known, every operand indexes
+// something that exists and every jump lands inside the function, then
+// cache_verify_stack checks the operand stack along each path
+static bool cache_verify(const CacheHeader* header, const CacheFunction* function,
+                         const Instruction* code) {
+    if (function->param_count < 0 || function->local_count < function->param_count ||
+        function->max_stack < 0 || function->local_count > VM_STACK_SIZE ||
+        function->max_stack > VM_STACK_SIZE) {
+        return false;
+    }
+
+    for (int i = 0; i < function->code_count; i++) {
+        const Instruction* instruction = &code[i];
+        switch (instruction->op) {
+            case OP_LOAD_STRING:
+                if (instruction->operand.string_index < 0 ||
+                    instruction->operand.string_index >= header->string_count) return false;
+                break;
+            case OP_LOAD_VAR:
+            case OP_STORE_VAR:
+                if (instruction->operand.var_index < 0 ||
+                    instruction->operand.var_index >= function->local_count) return false;
+                break;
+            case OP_LOAD_GLOBAL:
+            case OP_STORE_GLOBAL:
+                if (instruction->operand.var_index < 0 ||
+                    instruction->operand.var_index >= header->global_count) return false;
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE: {
+                int64_t target = (int64_t)i + 1 + instruction->operand.jump_offset;
+                if (target < 0 || target >= function->code_count) return false;
+                break;
+            }
+            case OP_CALL:
+                if (instruction->operand.call.function_index < 0 ||
+                    instruction->operand.call.function_index >= header->function_count ||
+                    instruction->operand.call.arg_count < 0) return false;
+                break;
+            case OP_PRINT:
+                if (instruction->operand.call.arg_count < 0) return false;
+                break;
+            case OP_CALL_NATIVE:
+                return false;   // never written, see calls_natives
+            default:
+                if ((unsigned)instruction->op > OP_HALT) return false;
+                break;
+        }
+    }
+
+    return cache_verify_stack(function, code);
+}
+
+// Returns NULL when there is no usable cache file for this source: missing,
+// written by another runtime version or for other source, cut short or
+// damaged
+BytecodeProgram* cache_load(const char* path, uint64_t hash, size_t source_length,
+                            bool optimized) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    struct stat info;
+    void* image = MAP_FAILED;
+    size_t size = 0;
+    if (fstat(fileno(file), &info) == 0 && (size_t)info.st_size >= sizeof(CacheHeader)) {
+        size = (size_t)info.st_size;
+        image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    }
+    fclose(file);
+    if (image == MAP_FAILED) return NULL;
+
+    const char* base = (const char*)image;
+    const CacheHeader* header = (const CacheHeader*)image;
+    CacheHeader expected;
+    cache_header(&expected, hash, source_length, optimized);
+
+    bool valid = memcmp(header, &expected, offsetof(CacheHeader, function_count)) == 0 &&
+                 header->file_size == size &&
+                 header->function_count > 0 && header->string_count >= 0 &&
+                 header->global_count >= 0;
+    uint64_t tables = cache_align(sizeof(CacheHeader));
+    const CacheFunction* functions = (const CacheFunction*)(base + tables);
+    uint64_t strings_offset = cache_align(tables + (uint64_t)header->function_count * sizeof(CacheFunction));
+    uint64_t globals_offset = cache_align(strings_offset + (uint64_t)header->string_count * sizeof(CacheString));
+    valid = valid && cache_span(header, tables, (uint64_t)header->function_count * sizeof(CacheFunction)) &&
+            cache_span(header, globals_offset, (uint64_t)header->global_count * sizeof(CacheString));
+    const CacheString* strings = (const CacheString*)(base + strings_offset);
+    const CacheString* globals = (const CacheString*)(base + globals_offset);
+
+    for (int i = 0; valid && i < header->function_count; i++) {
+        valid = functions[i].code_count > 0 && functions[i].code % sizeof(double) == 0 &&
+                cache_span(header, functions[i].code, (uint64_t)functions[i].code_count * sizeof(Instruction)) &&
+                cache_span(header, functions[i].name, functions[i].name_length) &&
+                cache_verify(header, &functions[i], (const Instruction*)(base + functions[i].code));
+    }
+    // The script's frame must fit the VM stack, as vm_execute checks
+    valid = valid && functions[0].local_count + functions[0].max_stack <= VM_STACK_SIZE;
+    for (int i = 0; valid && i < header->string_count; i++) {
+        valid = strings[i].length <= UINT32_MAX && cache_span(header, strings[i].chars, strings[i].length);
+    }
+    for (int i = 0; valid && i < header->global_count; i++) {
+        valid = globals[i].length <= UINT32_MAX && cache_span(header, globals[i].chars, globals[i].length);
+    }
+    if (!valid) {
+        munmap(image, size);
+        return NULL;
+    }
+
+    BytecodeProgram* program = (BytecodeProgram*)minall_malloc(sizeof(BytecodeProgram));
+    memset(program, 0, sizeof(BytecodeProgram));
+    program->image = image;
+    program->image_size = size;
+
+    program->function_count = program->function_capacity = header->function_count;
+    program->functions = (BytecodeFunction*)minall_malloc(header->function_count * sizeof(BytecodeFunction));
+    for (int i = 0; i < header->function_count; i++) {
+        BytecodeFunction* function = &program->functions[i];
+        function->name = atom_intern_span(base + functions[i].name, functions[i].name_length);
+        // The VM never writes to code, so it can stay in the read-only mapping
+        function->code = (Instruction*)(base + functions[i].code);
+        function->code_count = function->code_capacity = functions[i].code_count;
+        function->param_count = functions[i].param_count;
+        function->local_count = functions[i].local_count;
+        function->max_stack = functions[i].max_stack;
+    }
+
+    program->string_count = program->string_capacity = header->string_count;
+    program->strings = (String*)minall_malloc((header->string_count + 1) * sizeof(String));
+    for (int i = 0; i < header->string_count; i++) {
+        String* string = &program->strings[i];
+        string->length = (uint32_t)strings[i].length;
+        string->is_rope = false;
+        string->forwarded = false;
+        string->data.chars = base + strings[i].chars;
+    }
+
+    program->global_count = header->global_count;
+    program->global_names = (Atom**)minall_malloc((header->global_count + 1) * sizeof(Atom*));
+    for (int i = 0; i < header->global_count; i++) {
+        program->global_names[i] = atom_intern_span(base + globals[i].chars, (uint32_t)globals[i].length);
+    }
+
+    return program;
+}
+
+// Unmaps the file a loaded program runs from; the program must not run again
+void cache_release(BytecodeProgram* program) {
+    if (program->image) {
+        munmap((void*)program->image, program->image_size);
+        program->image = NULL;
+    }
+}
@@ -0,0 +1,501 @@
+#include "minall.h"
+
+// Bytecode compiler - lowers a resolved AST into one flat Instruction array
+// per function so the VM never has to chase tree pointers at run time.
+// Variable slots come from resolve_program.
+
+typedef struct {
+    BytecodeProgram* program;
+    BytecodeFunction* function;
+    int* bindings;      // function index -> bytecode function, -1 if none
+    int stack_depth;
+} Compiler;
+
+static void compile_statement(Compiler* compiler, ASTNode* stmt);
+static void compile_expression(Compiler* compiler, ASTNode* expr);
+
+// Net operand stack effect of each opcode; calls and print additionally
+// consume their arguments, which compile_call accounts for. cache.c checks
+// loaded code against the same counts.
+int opcode_stack_effect(OpCode op) {
+    switch (op) {
+        case OP_CALL:
+        case OP_CALL_NATIVE:
+        case OP_PRINT:
+        case OP_LOAD_NUMBER:
+        case OP_LOAD_STRING:
+        case OP_LOAD_UNDEFINED:
+        case OP_LOAD_VAR:
+        case OP_LOAD_GLOBAL:
+        case OP_DUP:
+            return 1;
+        case OP_NEG:
+        case OP_NOT:
+        case OP_JUMP:
+        case OP_HALT:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+static Instruction* emit(Compiler* compiler, OpCode op) {
+    BytecodeFunction* function = compiler->function;
+
+    if (function->code_count == function->code_capacity) {
+        int capacity = function->code_capacity ? function->code_capacity * 2 : 64;
+        Instruction* code = (Instruction*)minall_malloc(capacity * sizeof(Instruction));
+        if (function->code_count) {
+            memcpy(code, function->code, function->code_count * sizeof(Instruction));
+        }
+        function->code = code;
+        function->code_capacity = capacity;
+    }
+
+    compiler->stack_depth += opcode_stack_effect(op);
+    if (compiler->stack_depth > function->max_stack) {
+        function->max_stack = compiler->stack_depth;
+    }
+
+    Instruction* instruction = &function->code[function->code_count++];
+    instruction->op = op;
+    return instruction;
+}
+
+static int emit_jump(Compiler* compiler, OpCode op) {
+    emit(compiler, op)->operand.jump_offset = 0;
+    return compiler->function->code_count - 1;
+}
+
+static void patch_jump(Compiler* compiler, int jump) {
+    Instruction* code = compiler->function->code;
+    code[jump].operand.jump_offset = compiler->function->code_count - (jump + 1);
+}
+
+static void emit_loop(Compiler* compiler, int loop_start) {
+    int jump = emit_jump(compiler, OP_JUMP);
+    compiler->function->code[jump].operand.jump_offset = loop_start - (jump + 1);
+}
+
+static BytecodeFunction* add_function(BytecodeProgram* program) {
+    if (program->function_count == program->function_capacity) {
+        int capacity = program->function_capacity ? program->function_capacity * 2 : 16;
+        BytecodeFunction* functions = (BytecodeFunction*)minall_malloc(capacity * sizeof(BytecodeFunction));
+        if (program->function_count) {
+            memcpy(functions, program->functions, program->function_count * sizeof(BytecodeFunction));
+        }
+        program->functions = functions;
+        program->function_capacity = capacity;
+    }
+
+    BytecodeFunction* function = &program->functions[program->function_count++];
+    memset(function, 0, sizeof(BytecodeFunction));
+    return function;
+}
+
+// Appends a string constant; literals are not deduplicated, since a
+// repeated literal costs one String here and nothing at run time
+static int add_string(BytecodeProgram* program, String* string) {
+    if (program->string_count == program->string_capacity) {
+        int capacity = program->string_capacity ? program->string_capacity * 2 : 16;
+        String* strings = (String*)minall_malloc(capacity * sizeof(String));
+        if (program->string_count) {
+            memcpy(strings, program->strings, program->string_count * sizeof(String));
+        }
+        program->strings = strings;
+        program->string_capacity = capacity;
+    }
+
+    program->strings[program->string_count] = *string;
+    return program->string_count++;
+}
+
+// Register every function declaration in the tree so calls can be bound to
+// a function before its body has been compiled. The last declaration of a
+// name wins, as with JavaScript function hoisting.
+static void hoist_functions(BytecodeProgram* program, int* bindings, ASTNode* node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case NODE_FUNCTION_DECLARATION: {
+            BytecodeFunction* function = add_function(program);
+            function->name = node->data.func_decl.name;
+            function->param_count = node->data.func_decl.param_count;
+            if (node->data.func_decl.function_index >= 0) {
+                bindings[node->data.func_decl.function_index] = program->function_count - 1;
+            }
+            hoist_functions(program, bindings, node->data.func_decl.body);
+            break;
+        }
+        case NODE_BLOCK:
+        case NODE_PROGRAM:
+            for (int i = 0; i < node->data.block.count; i++) {
+                hoist_functions(program, bindings, node->data.block.statements[i]);
+            }
+            break;
+        case NODE_IF:
+            hoist_functions(program, bindings, node->data.if_stmt.then_branch);
+            hoist_functions(program, bindings, node->data.if_stmt.else_branch);
+            break;
+        case NODE_WHILE:
+            hoist_functions(program, bindings, node->data.while_stmt.body);
+            break;
+        case NODE_FOR:
+            hoist_functions(program, bindings, node->data.for_stmt.body);
+            break;
+        default:
+            break;
+    }
+}
+
+static void emit_load(Compiler* compiler, int slot, bool is_global) {
+    emit(compiler, is_global ? OP_LOAD_GLOBAL : OP_LOAD_VAR)->operand.var_index = slot;
+}
+
+static void emit_store(Compiler* compiler, int slot, bool is_global) {
+    emit(compiler, is_global ? OP_STORE_GLOBAL : OP_STORE_VAR)->operand.var_index = slot;
+}
+
+static OpCode binary_opcode(BinaryOperator operator) {
+    switch (operator) {
+        case BINARY_ADD: return OP_ADD;
+        case BINARY_SUB: return OP_SUB;
+        case BINARY_MUL: return OP_MUL;
+        case BINARY_DIV: return OP_DIV;
+        case BINARY_MOD: return OP_MOD;
+        case BINARY_LT:  return OP_CMP_LT;
+        case BINARY_LE:  return OP_CMP_LE;
+        case BINARY_GT:  return OP_CMP_GT;
+        case BINARY_GE:  return OP_CMP_GE;
+        case BINARY_EQ:  return OP_CMP_EQ;
+        case BINARY_NE:  return OP_CMP_NE;
+        case BINARY_AND: return OP_AND;
+        default:         return OP_OR;
+    }
+}
+
+static void compile_call(Compiler* compiler, ASTNode* expr) {
+    ASTNode** args = expr->data.call.args;
+    int arg_count = expr->data.call.arg_count;
+
+    int target = expr->data.call.target;
+    int index = target >= 0 ? compiler->bindings[target] : -1;
+    OpCode op = OP_CALL;
+    if (target <= CALL_NATIVE_BASE) {
+        op = OP_CALL_NATIVE;
+        index = CALL_NATIVE_BASE - target;
+    } else if (target == CALL_BUILTIN_PRINT) {
+        op = OP_PRINT;
+    } else if (index < 0) {
+        emit(compiler, OP_LOAD_UNDEFINED);
+        return;
+    }
+
+    for (int i = 0; i < arg_count; i++) {
+        compile_expression(compiler, args[i]);
+    }
+
+    Instruction* instruction = emit(compiler, op);
+    instruction->operand.call.function_index = index;
+    instruction->operand.call.arg_count = arg_count;
+
+    compiler->stack_depth -= arg_count;
+}
+
+static void compile_expression(Compiler* compiler, ASTNode* expr) {
+    if (!expr) {
+        emit(compiler, OP_LOAD_UNDEFINED);
+        return;
+    }
+
+    switch (expr->type) {
+        case NODE_NUMBER:
+            emit(compiler, OP_LOAD_NUMBER)->operand.number = expr->data.number;
+            break;
+
+        case NODE_STRING:
+            emit(compiler, OP_LOAD_STRING)->operand.string_index =
+                add_string(compiler->program, expr->data.string.value);
+            break;
+
+        case NODE_IDENTIFIER:
+            emit_load(compiler, expr->data.identifier.slot, expr->data.identifier.is_global);
+            break;
+
+        case NODE_BINARY_OP:
+        case NODE_BINARY_NUMERIC:
+        case NODE_BINARY_VAR_CONST:
+        case NODE_BINARY_VAR_VAR:
+        case NODE_NUMBERS_ADD: case NODE_NUMBERS_SUB: case NODE_NUMBERS_MUL:
+        case NODE_NUMBERS_DIV: case NODE_NUMBERS_MOD: case NODE_NUMBERS_LT:
+        case NODE_NUMBERS_LE: case NODE_NUMBERS_GT: case NODE_NUMBERS_GE:
+        case NODE_NUMBERS_EQ: case NODE_NUMBERS_NE: case NODE_NUMBERS_AND:
+        case NODE_NUMBERS_OR:
+        case NODE_BINARY_CONCAT:
+            compile_expression(compiler, expr->data.binary_op.left);
+            compile_expression(compiler, expr->data.binary_op.right);
+            emit(compiler, binary_opcode(expr->data.binary_op.operator));
+            break;
+
+        case NODE_UNARY_OP:
+            compile_expression(compiler, expr->data.unary_op.operand);
+            emit(compiler, expr->data.unary_op.operator == UNARY_NEG ? OP_NEG : OP_NOT);
+            break;
+
+        case NODE_ASSIGNMENT: {
+            ASTNode* target = expr->data.binary_op.left;
+            if (target->type != NODE_IDENTIFIER) {
+                emit(compiler, OP_LOAD_UNDEFINED);
+                break;
+            }
+            compile_expression(compiler, expr->data.binary_op.right);
+            emit(compiler, OP_DUP);
+            emit_store(compiler, target->data.identifier.slot, target->data.identifier.is_global);
+            break;
+        }
+
+        case NODE_CALL:
+        case NODE_CALL_FUNCTION:
+            compile_call(compiler, expr);
+            break;
+
+        default:
+            emit(compiler, OP_LOAD_UNDEFINED);
+            break;
+    }
+}
+
+static void compile_statement(Compiler* compiler, ASTNode* stmt) {
+    if (!stmt) return;
+
+    switch (stmt->type) {
+        case NODE_VAR_DECLARATION:
+            compile_expression(compiler, stmt->data.var_decl.value);
+            emit_store(compiler, stmt->data.var_decl.slot, stmt->data.var_decl.is_global);
+            break;
+
+        case NODE_FUNCTION_DECLARATION:
+            // Hoisted and compiled separately
+            break;
+
+        case NODE_IF: {
+            compile_expression(compiler, stmt->data.if_stmt.condition);
+            int else_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
+            compile_statement(compiler, stmt->data.if_stmt.then_branch);
+
+            if (stmt->data.if_stmt.else_branch) {
+                int end_jump = emit_jump(compiler, OP_JUMP);
+                patch_jump(compiler, else_jump);
+                compile_statement(compiler, stmt->data.if_stmt.else_branch);
+                patch_jump(compiler, end_jump);
+            } else {
+                patch_jump(compiler, else_jump);
+            }
+            break;
+        }
+
+        case NODE_WHILE: {
+            int loop_start = compiler->function->code_count;
+            compile_expression(compiler, stmt->data.while_stmt.condition);
+            int exit_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
+            compile_statement(compiler, stmt->data.while_stmt.body);
+            emit_loop(compiler, loop_start);
+            patch_jump(compiler, exit_jump);
+            break;
+        }
+
+        case NODE_FOR: {
+            compile_statement(compiler, stmt->data.for_stmt.init);
+            int loop_start = compiler->function->code_count;
+            int exit_jump = -1;
+            if (stmt->data.for_stmt.condition) {
+                compile_expression(compiler, stmt->data.for_stmt.condition);
+                exit_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
+            }
+            compile_statement(compiler, stmt->data.for_stmt.body);
+            compile_statement(compiler, stmt->data.for_stmt.update);
+            emit_loop(compiler, loop_start);
+            if (exit_jump >= 0) {
+                patch_jump(compiler, exit_jump);
+            }
+            break;
+        }
+
+        case NODE_RETURN:
+            compile_expression(compiler, stmt->data.return_stmt.value);
+            emit(compiler, OP_RETURN);
+            break;
+
+        case NODE_BLOCK:
+        case NODE_PROGRAM:
+            for (int i = 0; i < stmt->data.block.count; i++) {
+                compile_statement(compiler, stmt->data.block.statements[i]);
+            }
+            break;
+
+        case NODE_ASSIGNMENT: {
+            // Statement-level assignment: no need to keep the value around
+            ASTNode* target = stmt->data.binary_op.left;
+            if (target->type == NODE_IDENTIFIER) {
+                compile_expression(compiler, stmt->data.binary_op.right);
+                emit_store(compiler, target->data.identifier.slot, target->data.identifier.is_global);
+                break;
+            }
+        }
+            // fall through
+
+        default:
+            compile_expression(compiler, stmt);
+            emit(compiler, OP_POP);
+            break;
+    }
+}
+
+static void compile_function(BytecodeProgram* program, int* bindings,
+                             BytecodeFunction* function, ASTNode* decl) {
+    Compiler compiler;
+    compiler.program = program;
+    compiler.function = function;
+    compiler.bindings = bindings;
+    compiler.stack_depth = 0;
+    function->local_count = decl->data.func_decl.local_count;
+
+    if (decl->data.func_decl.body) {
+        compile_statement(&compiler, decl->data.func_decl.body);
+    }
+
+    emit(&compiler, OP_LOAD_UNDEFINED);
+    emit(&compiler, OP_RETURN);
+}
+
+static void compile_nested_functions(BytecodeProgram* program, int* bindings,
+                                     ASTNode* node, int* next_index) {
+    if (!node) return;
+
+    switch (node->type) {
+        case NODE_FUNCTION_DECLARATION: {
+            if (*next_index >= program->function_count) return;
+            BytecodeFunction* function = &program->functions[(*next_index)++];
+            compile_function(program, bindings, function, node);
+            compile_nested_functions(program, bindings, node->data.func_decl.body, next_index);
+            break;
+        }
+        case NODE_BLOCK:
+        case NODE_PROGRAM:
+            for (int i = 0; i < node->data.block.count; i++) {
+                compile_nested_functions(program, bindings, node->data.block.statements[i], next_index);
+            }
+            break;
+        case NODE_IF:
+            compile_nested_functions(program, bindings, node->data.if_stmt.then_branch, next_index);
+            compile_nested_functions(program, bindings, node->data.if_stmt.else_branch, next_index);
+            break;
+        case NODE_WHILE:
+            compile_nested_functions(program, bindings, node->data.while_stmt.body, next_index);
+            break;
+        case NODE_FOR:
+            compile_nested_functions(program, bindings, node->data.for_stmt.body, next_index);
+            break;
+        default:
+            break;
+    }
+}
+
+BytecodeProgram* compile_program(ASTNode* ast) {
+    BytecodeProgram* program = (BytecodeProgram*)minall_malloc(sizeof(BytecodeProgram));
+    memset(program, 0, sizeof(BytecodeProgram));
+    program->global_names = ast->data.block.global_names;
+    program->global_count = ast->data.block.global_count;
+
+    add_function(program)->name = atom_intern("<script>", 8);
+
+    int binding_count = ast->data.block.function_count;
+    int* bindings = (int*)minall_malloc((binding_count + 1) * sizeof(int));
+    for (int i = 0; i < binding_count; i++) {
+        bindings[i] = -1;
+    }
+    hoist_functions(program, bindings, ast);
+
+    // Function bodies are compiled in the same order they were hoisted
+    int next_index = 1;
+    compile_nested_functions(program, bindings, ast, &next_index);
+
+    Compiler compiler;
+    compiler.program = program;
+    compiler.function = &program->functions[0];
+    compiler.bindings = bindings;
+    compiler.stack_depth = 0;
+
+    compile_statement(&compiler, ast);
+    emit(&compiler, OP_HALT);
+
+    return program;
+}
+
+const char* opcode_name(OpCode op) {
+    static const char* names[] = {
+        "LOAD_NUMBER", "LOAD_STRING", "LOAD_UNDEFINED", "LOAD_VAR", "STORE_VAR",
+        "LOAD_GLOBAL", "STORE_GLOBAL", "DUP", "POP", "ADD", "SUB", "MUL", "DIV",
+        "MOD", "NEG", "NOT", "AND", "OR", "CMP_LT", "CMP_LE", "CMP_GT", "CMP_GE",
+        "CMP_EQ", "CMP_NE", "JUMP", "JUMP_IF_FALSE", "CALL", "CALL_NATIVE", "PRINT", "RETURN",
+        "HALT"
+    };
+    return names[op];
+}
+
+void print_bytecode(BytecodeProgram* program) {
+    for (int f = 0; f < program->function_count; f++) {
+        BytecodeFunction* function = &program->functions[f];
+        printf("Function %d: %.*s (%d params, %d slots, stack %d)\n", f,
+               (int)function->name->length, function->name->chars,
+               function->param_count, function->local_count, function->max_stack);
+
+        for (int i = 0; i < function->code_count; i++) {
+            Instruction* instruction = &function->code[i];
+            printf("  %4d %-14s", i, opcode_name(instruction->op));
+
+            switch (instruction->op) {
+                case OP_LOAD_NUMBER:
+                    printf(" %.2f", instruction->operand.number);
+                    break;
+                case OP_LOAD_STRING:
+                    printf(" \"");
+                    string_print(&program->strings[instruction->operand.string_index], stdout);
+                    printf("\"");
+                    break;
+                case OP_LOAD_VAR:
+                case OP_STORE_VAR:
+                    printf(" slot %d", instruction->operand.var_index);
+                    break;
+                case OP_LOAD_GLOBAL:
+                case OP_STORE_GLOBAL: {
+                    Atom* name = program->global_names[instruction->operand.var_index];
+                    printf(" %.*s", (int)name->length, name->chars);
+                    break;
+                }
+                case OP_JUMP:
+                case OP_JUMP_IF_FALSE:
+                    printf(" -> %d", i + 1 + instruction->operand.jump_offset);
+                    break;
+                case OP_CALL: {
+                    Atom* name = program->functions[instruction->operand.call.function_index].name;
+                    printf(" %.*s/%d", (int)name->length, name->chars,
+                           instruction->operand.call.arg_count);
+                    break;
+                }
+                case OP_CALL_NATIVE: {
+                    Native* native = &minall_current->natives[instruction->operand.call.function_index];
+                    printf(" %.*s/%d", (int)native->length, native->chars,
+                           instruction->operand.call.arg_count);
+                    break;
+                }
+                case OP_PRINT:
+                    printf(" /%d", instruction->operand.call.arg_count);
+                    break;
+                default:
+                    break;
+            }
+            printf("\n");
+        }
+    }
+}
@@ -1,70 +1,575 @@
 #include "minall.h"
 
-// Ultra-fast loop execution engine - optimized for performance
-// This gives MinAll a significant speed advantage over other runtimes
+// Counted-loop engine for the tree walker. A loop of the form
+//
+//     for (var i = a; i < b; i = i + k) body
+//
+// whose bounds and body only compute numbers (no calls, strings or returns)
+// is compiled once into a small stack program over doubles and cached on
+// its NODE_FOR. Each run loads the loop's variables from the Context into
+// a FastVM, runs the program on it and writes the results back. The FastVM
+// and the compiler's scratch space live on the C stack of the run, so the
+// engine keeps no state of its own between runs and any number of isolates
+// can use it at once.
+// Any other loop, or one whose variables do not hold numbers on entry,
+// stays on the interpreter.
+
+#define FAST_STACK_SIZE 1000
+#define FAST_MAX_VARIABLES 100
+#define FAST_MAX_CODE 1024
 
 typedef struct {
-    double* stack;
+    double stack[FAST_STACK_SIZE];
     int stack_ptr;
-    double* variables;
+    double variables[FAST_MAX_VARIABLES];
     int var_count;
 } FastVM;
 
-static FastVM fast_vm;
-static double stack_memory[1000];
-static double var_memory[100];
+typedef enum {
+    FAST_PUSH,              // push number
+    FAST_LOAD,              // push variable a
+    FAST_STORE,             // pop into variable a
+    FAST_POP,
+    FAST_BINARY,            // apply operator to the top two numbers
+    FAST_VAR_CONST,         // push variable a <operator> number
+    FAST_VAR_VAR,           // push variable a <operator> variable b
+    FAST_INCREMENT,         // variable a += number
+    FAST_NEG,
+    FAST_NOT,
+    FAST_JUMP,              // continue at instruction target
+    FAST_JUMP_IF_FALSE,     // pop, continue at target if it was 0
+    FAST_BRANCH_VAR_CONST,  // continue at target unless variable a <operator> number
+    FAST_BRANCH_VAR_VAR,    // continue at target unless variable a <operator> variable b
+    FAST_HALT
+} FastOp;
+
+typedef struct {
+    FastOp op;
+    BinaryOperator operator;
+    int a;
+    int b;
+    int target;
+    double number;
+} FastInstruction;
+
+struct FastLoop {
+    FastInstruction* code;
+    int* slots;             // Context slot of each FastVM variable
+    bool* is_global;
+    int var_count;
+    int counter;            // written by the initializer before any read
+};
 
-void init_fast_vm() {
-    fast_vm.stack = stack_memory;
-    fast_vm.stack_ptr = 0;
-    fast_vm.variables = var_memory;
-    fast_vm.var_count = 0;
-    
-    // Initialize all variables to 0
-    for (int i = 0; i < 100; i++) {
-        fast_vm.variables[i] = 0.0;
+typedef struct {
+    FastInstruction code[FAST_MAX_CODE];
+    int code_count;
+    int slots[FAST_MAX_VARIABLES];
+    bool is_global[FAST_MAX_VARIABLES];
+    int var_count;
+    int depth;
+    bool failed;
+} FastCompiler;
+
+// Loop shape detection
+
+static bool is_binary(ASTNode* node) {
+    switch (node->type) {
+        case NODE_BINARY_OP:
+        case NODE_BINARY_NUMERIC:
+        case NODE_BINARY_VAR_CONST:
+        case NODE_BINARY_VAR_VAR:
+            return true;
+        default:
+            return false;
     }
 }
 
-// Detect and optimize simple for loops
+static bool is_variable(ASTNode* node, int slot, bool is_global) {
+    return node && node->type == NODE_IDENTIFIER &&
+           node->data.identifier.slot == slot && node->data.identifier.is_global == is_global;
+}
+
+static bool is_numeric_expression(ASTNode* node) {
+    if (!node) return false;
+
+    switch (node->type) {
+        case NODE_NUMBER:
+            return true;
+        case NODE_IDENTIFIER:
+            return node->data.identifier.slot >= 0;
+        case NODE_UNARY_OP:
+            return is_numeric_expression(node->data.unary_op.operand);
+        default:
+            return is_binary(node) &&
+                   is_numeric_expression(node->data.binary_op.left) &&
+                   is_numeric_expression(node->data.binary_op.right);
+    }
+}
+
+static bool reads_variable(ASTNode* node, int slot, bool is_global) {
+    if (!node) return false;
+    if (is_variable(node, slot, is_global)) return true;
+    if (node->type == NODE_UNARY_OP) {
+        return reads_variable(node->data.unary_op.operand, slot, is_global);
+    }
+    return is_binary(node) &&
+           (reads_variable(node->data.binary_op.left, slot, is_global) ||
+            reads_variable(node->data.binary_op.right, slot, is_global));
+}
+
+static bool is_numeric_statement(ASTNode* node) {
+    if (!node) return true;
+
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (int i = 0; i < node->data.block.count; i++) {
+                if (!is_numeric_statement(node->data.block.statements[i])) return false;
+            }
+            return true;
+        case NODE_VAR_DECLARATION:
+            return node->data.var_decl.slot >= 0 && is_numeric_expression(node->data.var_decl.value);
+        case NODE_ASSIGNMENT:
+            return node->data.binary_op.left->type == NODE_IDENTIFIER &&
+                   node->data.binary_op.left->data.identifier.slot >= 0 &&
+                   is_numeric_expression(node->data.binary_op.right);
+        case NODE_IF:
+            return is_numeric_expression(node->data.if_stmt.condition) &&
+                   is_numeric_statement(node->data.if_stmt.then_branch) &&
+                   is_numeric_statement(node->data.if_stmt.else_branch);
+        case NODE_WHILE:
+            return is_numeric_expression(node->data.while_stmt.condition) &&
+                   is_numeric_statement(node->data.while_stmt.body);
+        case NODE_FOR:
+            return is_numeric_statement(node->data.for_stmt.init) &&
+                   (!node->data.for_stmt.condition ||
+                    is_numeric_expression(node->data.for_stmt.condition)) &&
+                   is_numeric_statement(node->data.for_stmt.update) &&
+                   is_numeric_statement(node->data.for_stmt.body);
+        default:
+            return is_numeric_expression(node);
+    }
+}
+
+// for (var i = a; i <op> b; i = i +/- k) with a numeric-only body
 bool is_simple_for_loop(ASTNode* node) {
     if (node->type != NODE_FOR) return false;
-    
-    // Check if it's a simple numeric loop pattern
-    // for (var i = start; i < end; i = i + 1) { simple_body }
-    return true; // Simplified detection for now
+
+    ASTNode* init = node->data.for_stmt.init;
+    ASTNode* condition = node->data.for_stmt.condition;
+    ASTNode* update = node->data.for_stmt.update;
+    if (!init || !condition || !update) return false;
+
+    int slot;
+    bool is_global;
+    ASTNode* start;
+    if (init->type == NODE_VAR_DECLARATION) {
+        slot = init->data.var_decl.slot;
+        is_global = init->data.var_decl.is_global;
+        start = init->data.var_decl.value;
+    } else if (init->type == NODE_ASSIGNMENT && init->data.binary_op.left->type == NODE_IDENTIFIER) {
+        slot = init->data.binary_op.left->data.identifier.slot;
+        is_global = init->data.binary_op.left->data.identifier.is_global;
+        start = init->data.binary_op.right;
+    } else {
+        return false;
+    }
+    if (slot < 0 || !is_numeric_expression(start) || reads_variable(start, slot, is_global)) {
+        return false;
+    }
+
+    if (!is_binary(condition) || !is_variable(condition->data.binary_op.left, slot, is_global) ||
+        !is_numeric_expression(condition->data.binary_op.right)) {
+        return false;
+    }
+    switch (condition->data.binary_op.operator) {
+        case BINARY_LT:
+        case BINARY_LE:
+        case BINARY_GT:
+        case BINARY_GE:
+        case BINARY_NE:
+            break;
+        default:
+            return false;
+    }
+
+    ASTNode* step = update->type == NODE_ASSIGNMENT ? update->data.binary_op.right : NULL;
+    if (!step || !is_variable(update->data.binary_op.left, slot, is_global) || !is_binary(step) ||
+        (step->data.binary_op.operator != BINARY_ADD && step->data.binary_op.operator != BINARY_SUB) ||
+        !is_variable(step->data.binary_op.left, slot, is_global) ||
+        step->data.binary_op.right->type != NODE_NUMBER) {
+        return false;
+    }
+
+    return is_numeric_statement(node->data.for_stmt.body);
 }
 
-// Execute optimized loop - much faster than interpreter
-double execute_fast_loop(ASTNode* for_node, Context* ctx) {
-    init_fast_vm();
-    
-    // For demonstration, execute a simple counting loop extremely fast
-    // This would be expanded to handle more complex cases
-    
-    double sum = 0;
-    for (int i = 0; i < 1000; i++) {
-        sum += i * i - i / 2.0 + (i % 7);
+// Compilation to FastVM code
+
+static FastInstruction* fast_emit(FastCompiler* compiler, FastOp op, int stack_effect) {
+    if (compiler->code_count >= FAST_MAX_CODE) {
+        compiler->failed = true;
+        compiler->code_count = 0;
     }
-    
-    return sum;
+
+    compiler->depth += stack_effect;
+    if (compiler->depth > FAST_STACK_SIZE) {
+        compiler->failed = true;
+    }
+
+    FastInstruction* instruction = &compiler->code[compiler->code_count++];
+    memset(instruction, 0, sizeof(FastInstruction));
+    instruction->op = op;
+    return instruction;
 }
 
-// Fast arithmetic operations using native CPU instructions
-static INLINE double fast_add(double a, double b) {
-    return a + b;
+static int fast_variable(FastCompiler* compiler, int slot, bool is_global) {
+    for (int i = 0; i < compiler->var_count; i++) {
+        if (compiler->slots[i] == slot && compiler->is_global[i] == is_global) {
+            return i;
+        }
+    }
+    if (compiler->var_count >= FAST_MAX_VARIABLES) {
+        compiler->failed = true;
+        return 0;
+    }
+    compiler->slots[compiler->var_count] = slot;
+    compiler->is_global[compiler->var_count] = is_global;
+    return compiler->var_count++;
 }
 
-static INLINE double fast_mul(double a, double b) {
-    return a * b;
+static void fast_store(FastCompiler* compiler, int slot, bool is_global) {
+    int index = fast_variable(compiler, slot, is_global);
+    fast_emit(compiler, FAST_STORE, -1)->a = index;
 }
 
-static INLINE double fast_div(double a, double b) {
-    return a / b;
+static int fast_identifier(FastCompiler* compiler, ASTNode* node) {
+    return fast_variable(compiler, node->data.identifier.slot, node->data.identifier.is_global);
 }
 
-static INLINE int fast_mod(int a, int b) {
-    return a % b;
+static void compile_fast_expression(FastCompiler* compiler, ASTNode* node) {
+    switch (node->type) {
+        case NODE_NUMBER:
+            fast_emit(compiler, FAST_PUSH, 1)->number = node->data.number;
+            break;
+        case NODE_IDENTIFIER: {
+            int index = fast_identifier(compiler, node);
+            fast_emit(compiler, FAST_LOAD, 1)->a = index;
+            break;
+        }
+        case NODE_UNARY_OP:
+            compile_fast_expression(compiler, node->data.unary_op.operand);
+            fast_emit(compiler, node->data.unary_op.operator == UNARY_NEG ? FAST_NEG : FAST_NOT, 0);
+            break;
+        default: {
+            ASTNode* left = node->data.binary_op.left;
+            ASTNode* right = node->data.binary_op.right;
+            FastInstruction* instruction;
+
+            if (left->type == NODE_IDENTIFIER && right->type == NODE_NUMBER) {
+                int index = fast_identifier(compiler, left);
+                instruction = fast_emit(compiler, FAST_VAR_CONST, 1);
+                instruction->a = index;
+                instruction->number = right->data.number;
+            } else if (left->type == NODE_IDENTIFIER && right->type == NODE_IDENTIFIER) {
+                int a = fast_identifier(compiler, left);
+                int b = fast_identifier(compiler, right);
+                instruction = fast_emit(compiler, FAST_VAR_VAR, 1);
+                instruction->a = a;
+                instruction->b = b;
+            } else {
+                compile_fast_expression(compiler, left);
+                compile_fast_expression(compiler, right);
+                instruction = fast_emit(compiler, FAST_BINARY, -1);
+            }
+            instruction->operator = node->data.binary_op.operator;
+            break;
+        }
+    }
+}
+
+// Emits a jump taken when condition is false and returns it for patching
+static int compile_fast_condition(FastCompiler* compiler, ASTNode* condition) {
+    FastInstruction* instruction;
+
+    if (is_binary(condition) && condition->data.binary_op.left->type == NODE_IDENTIFIER) {
+        ASTNode* right = condition->data.binary_op.right;
+        int a = fast_identifier(compiler, condition->data.binary_op.left);
+
+        if (right->type == NODE_NUMBER) {
+            instruction = fast_emit(compiler, FAST_BRANCH_VAR_CONST, 0);
+            instruction->a = a;
+            instruction->number = right->data.number;
+            instruction->operator = condition->data.binary_op.operator;
+            return compiler->code_count - 1;
+        }
+        if (right->type == NODE_IDENTIFIER) {
+            int b = fast_identifier(compiler, right);
+            instruction = fast_emit(compiler, FAST_BRANCH_VAR_VAR, 0);
+            instruction->a = a;
+            instruction->b = b;
+            instruction->operator = condition->data.binary_op.operator;
+            return compiler->code_count - 1;
+        }
+    }
+
+    compile_fast_expression(compiler, condition);
+    fast_emit(compiler, FAST_JUMP_IF_FALSE, -1);
+    return compiler->code_count - 1;
+}
+
+static int fast_jump(FastCompiler* compiler) {
+    fast_emit(compiler, FAST_JUMP, 0);
+    return compiler->code_count - 1;
+}
+
+static void fast_loop_back(FastCompiler* compiler, int loop_start) {
+    fast_emit(compiler, FAST_JUMP, 0)->target = loop_start;
+}
+
+static void fast_patch(FastCompiler* compiler, int jump) {
+    compiler->code[jump].target = compiler->code_count;
+}
+
+static void compile_fast_statement(FastCompiler* compiler, ASTNode* node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (int i = 0; i < node->data.block.count; i++) {
+                compile_fast_statement(compiler, node->data.block.statements[i]);
+            }
+            break;
+        case NODE_VAR_DECLARATION:
+            compile_fast_expression(compiler, node->data.var_decl.value);
+            fast_store(compiler, node->data.var_decl.slot, node->data.var_decl.is_global);
+            break;
+        case NODE_ASSIGNMENT: {
+            ASTNode* target = node->data.binary_op.left;
+            ASTNode* value = node->data.binary_op.right;
+
+            // x = x + k and x = x - k
+            if (is_binary(value) && value->data.binary_op.right->type == NODE_NUMBER &&
+                (value->data.binary_op.operator == BINARY_ADD || value->data.binary_op.operator == BINARY_SUB) &&
+                is_variable(value->data.binary_op.left, target->data.identifier.slot,
+                            target->data.identifier.is_global)) {
+                double step = value->data.binary_op.right->data.number;
+                int index = fast_identifier(compiler, target);
+                FastInstruction* instruction = fast_emit(compiler, FAST_INCREMENT, 0);
+                instruction->a = index;
+                instruction->number = value->data.binary_op.operator == BINARY_ADD ? step : -step;
+                break;
+            }
+
+            compile_fast_expression(compiler, value);
+            fast_store(compiler, target->data.identifier.slot, target->data.identifier.is_global);
+            break;
+        }
+        case NODE_IF: {
+            int else_jump = compile_fast_condition(compiler, node->data.if_stmt.condition);
+            compile_fast_statement(compiler, node->data.if_stmt.then_branch);
+            if (node->data.if_stmt.else_branch) {
+                int end_jump = fast_jump(compiler);
+                fast_patch(compiler, else_jump);
+                compile_fast_statement(compiler, node->data.if_stmt.else_branch);
+                fast_patch(compiler, end_jump);
+            } else {
+                fast_patch(compiler, else_jump);
+            }
+            break;
+        }
+        case NODE_WHILE: {
+            int loop_start = compiler->code_count;
+            int exit_jump = compile_fast_condition(compiler, node->data.while_stmt.condition);
+            compile_fast_statement(compiler, node->data.while_stmt.body);
+            fast_loop_back(compiler, loop_start);
+            fast_patch(compiler, exit_jump);
+            break;
+        }
+        case NODE_FOR: {
+            compile_fast_statement(compiler, node->data.for_stmt.init);
+            int loop_start = compiler->code_count;
+            int exit_jump = -1;
+            if (node->data.for_stmt.condition) {
+                exit_jump = compile_fast_condition(compiler, node->data.for_stmt.condition);
+            }
+            compile_fast_statement(compiler, node->data.for_stmt.body);
+            compile_fast_statement(compiler, node->data.for_stmt.update);
+            fast_loop_back(compiler, loop_start);
+            if (exit_jump >= 0) {
+                fast_patch(compiler, exit_jump);
+            }
+            break;
+        }
+        default:
+            compile_fast_expression(compiler, node);
+            fast_emit(compiler, FAST_POP, -1);
+            break;
+    }
+}
+
+static struct FastLoop* compile_fast_loop(ASTNode* for_node) {
+    FastCompiler scratch;
+    FastCompiler* compiler = &scratch;
+    compiler->code_count = 0;
+    compiler->var_count = 0;
+    compiler->depth = 0;
+    compiler->failed = false;
+
+    // The counter is the first variable the initializer stores to
+    ASTNode* init = for_node->data.for_stmt.init;
+    int counter = init->type == NODE_VAR_DECLARATION
+        ? fast_variable(compiler, init->data.var_decl.slot, init->data.var_decl.is_global)
+        : fast_variable(compiler, init->data.binary_op.left->data.identifier.slot,
+                        init->data.binary_op.left->data.identifier.is_global);
+
+    compile_fast_statement(compiler, for_node);
+    fast_emit(compiler, FAST_HALT, 0);
+    if (compiler->failed) return NULL;
+
+    struct FastLoop* loop = (struct FastLoop*)minall_malloc(sizeof(struct FastLoop));
+    loop->code = (FastInstruction*)minall_malloc(compiler->code_count * sizeof(FastInstruction));
+    memcpy(loop->code, compiler->code, compiler->code_count * sizeof(FastInstruction));
+    loop->slots = (int*)minall_malloc(compiler->var_count * sizeof(int));
+    memcpy(loop->slots, compiler->slots, compiler->var_count * sizeof(int));
+    loop->is_global = (bool*)minall_malloc(compiler->var_count * sizeof(bool));
+    memcpy(loop->is_global, compiler->is_global, compiler->var_count * sizeof(bool));
+    loop->var_count = compiler->var_count;
+    loop->counter = counter;
+    return loop;
+}
+
+static void run_fast_code(FastVM* vm, const FastInstruction* code) {
+    double* stack = vm->stack;
+    double* vars = vm->variables;
+    int sp = 0;
+    const FastInstruction* ip = code;
+
+#ifdef MINALL_THREADED_DISPATCH
+    static const void* dispatch_table[] = {
+        [FAST_PUSH] = &&do_FAST_PUSH,
+        [FAST_LOAD] = &&do_FAST_LOAD,
+        [FAST_STORE] = &&do_FAST_STORE,
+        [FAST_POP] = &&do_FAST_POP,
+        [FAST_BINARY] = &&do_FAST_BINARY,
+        [FAST_VAR_CONST] = &&do_FAST_VAR_CONST,
+        [FAST_VAR_VAR] = &&do_FAST_VAR_VAR,
+        [FAST_INCREMENT] = &&do_FAST_INCREMENT,
+        [FAST_NEG] = &&do_FAST_NEG,
+        [FAST_NOT] = &&do_FAST_NOT,
+        [FAST_JUMP] = &&do_FAST_JUMP,
+        [FAST_JUMP_IF_FALSE] = &&do_FAST_JUMP_IF_FALSE,
+        [FAST_BRANCH_VAR_CONST] = &&do_FAST_BRANCH_VAR_CONST,
+        [FAST_BRANCH_VAR_VAR] = &&do_FAST_BRANCH_VAR_VAR,
+        [FAST_HALT] = &&do_FAST_HALT,
+    };
+
+#define FAST_CASE(op) do_##op:
+#define FAST_JUMP_TO(index) ip = code + (index); goto *dispatch_table[ip->op]
+#define FAST_DISPATCH() goto *dispatch_table[(++ip)->op]
+
+    goto *dispatch_table[ip->op];
+#else
+#define FAST_CASE(op) case op:
+#define FAST_JUMP_TO(index) ip = code + (index); continue
+#define FAST_DISPATCH() ip++; continue
+
+    for (;;) {
+        switch (ip->op) {
+#endif
+            FAST_CASE(FAST_PUSH)
+                stack[sp++] = ip->number;
+                FAST_DISPATCH();
+            FAST_CASE(FAST_LOAD)
+                stack[sp++] = vars[ip->a];
+                FAST_DISPATCH();
+            FAST_CASE(FAST_STORE)
+                vars[ip->a] = stack[--sp];
+                FAST_DISPATCH();
+            FAST_CASE(FAST_POP)
+                sp--;
+                FAST_DISPATCH();
+            FAST_CASE(FAST_BINARY)
+                sp--;
+                stack[sp - 1] = numeric_binary_op(ip->operator, stack[sp - 1], stack[sp]);
+                FAST_DISPATCH();
+            FAST_CASE(FAST_VAR_CONST)
+                stack[sp++] = numeric_binary_op(ip->operator, vars[ip->a], ip->number);
+                FAST_DISPATCH();
+            FAST_CASE(FAST_VAR_VAR)
+                stack[sp++] = numeric_binary_op(ip->operator, vars[ip->a], vars[ip->b]);
+                FAST_DISPATCH();
+            FAST_CASE(FAST_INCREMENT)
+                vars[ip->a] += ip->number;
+                FAST_DISPATCH();
+            FAST_CASE(FAST_NEG)
+                stack[sp - 1] = -stack[sp - 1];
+                FAST_DISPATCH();
+            FAST_CASE(FAST_NOT)
+                stack[sp - 1] = stack[sp - 1] != 0 ? 0 : 1;
+                FAST_DISPATCH();
+            FAST_CASE(FAST_JUMP)
+                FAST_JUMP_TO(ip->target);
+            FAST_CASE(FAST_JUMP_IF_FALSE)
+                if (stack[--sp] == 0) {
+                    FAST_JUMP_TO(ip->target);
+                }
+                FAST_DISPATCH();
+            FAST_CASE(FAST_BRANCH_VAR_CONST)
+                if (numeric_binary_op(ip->operator, vars[ip->a], ip->number) == 0) {
+                    FAST_JUMP_TO(ip->target);
+                }
+                FAST_DISPATCH();
+            FAST_CASE(FAST_BRANCH_VAR_VAR)
+                if (numeric_binary_op(ip->operator, vars[ip->a], vars[ip->b]) == 0) {
+                    FAST_JUMP_TO(ip->target);
+                }
+                FAST_DISPATCH();
+            FAST_CASE(FAST_HALT)
+                vm->stack_ptr = sp;
+                return;
+#ifndef MINALL_THREADED_DISPATCH
+        }
+    }
+#endif
+
+#undef FAST_CASE
+#undef FAST_JUMP_TO
+#undef FAST_DISPATCH
+}
+
+// Runs a counted loop on the FastVM. Returns false, without running
+// anything, if the loop has to be interpreted instead.
+bool execute_fast_loop(ASTNode* for_node, Context* ctx) {
+    if (!for_node->data.for_stmt.fast_checked) {
+        for_node->data.for_stmt.fast_checked = true;
+        if (is_simple_for_loop(for_node)) {
+            for_node->data.for_stmt.fast_loop = compile_fast_loop(for_node);
+        }
+    }
+
+    struct FastLoop* loop = for_node->data.for_stmt.fast_loop;
+    if (!loop) return false;
+
+    FastVM vm;
+    vm.stack_ptr = 0;
+    for (int i = 0; i < loop->var_count; i++) {
+        Value value = *variable_slot(ctx, loop->slots[i], loop->is_global[i]);
+        if (value_is_number(value)) {
+            vm.variables[i] = value_as_number(value);
+        } else if (i == loop->counter) {
+            vm.variables[i] = 0;
+        } else {
+            return false;
+        }
+    }
+    vm.var_count = loop->var_count;
+
+    run_fast_code(&vm, loop->code);
+
+    for (int i = 0; i < loop->var_count; i++) {
+        *variable_slot(ctx, loop->slots[i], loop->is_global[i]) = value_number(vm.variables[i]);
+    }
+    return true;
 }
 
 // Vectorized operations for bulk calculations
@@ -77,4 +582,4 @@ void vectorized_add(double* a, double* b, double* result, int count) {
 // Cache-friendly memory access patterns
 void prefetch_memory(void* addr) {
     __builtin_prefetch(addr, 0, 3);
-}
\ No newline at end of file
+}
@@ -0,0 +1,165 @@
+// clock_gettime is not part of C99
+#define _POSIX_C_SOURCE 199309L
+#include "minall.h"
+
+// Precise copying collector for the value arena
+//
+// A collection covers the arena from some offset up to the top; everything
+// below it is older and stays where it is. The caller starts one with
+// gc_begin(), hands every root that may refer into that range to gc_trace()
+// exactly once, and finishes with gc_end(). Reachable strings are copied
+// above the top of the arena, breadth first through rope children (Cheney),
+// leaving a forwarding pointer behind so shared strings stay shared; the
+// copies are then moved down to the start of the range as one block and
+// the rest of the range is free again. Pointers are written as the final
+// addresses straight away, so nothing needs fixing up after the move.
+//
+// Strings are immutable apart from string_chars() flattening a rope, which
+// can give an old rope a younger buffer. minall_keep() protects such
+// buffers, so a minor collection starts above value_kept. A major
+// collection starts at 0 and copies a flattened rope as a flat string, so
+// it may only run where no mark/release region is open.
+//
+// The tree walker runs minor collections when its call and loop regions
+// compact (the region is the young generation) and major ones between
+// top-level statements; the VM, whose stack holds every live value, runs
+// major ones after string concatenation. Both trigger major collections
+// once the arena grows past the isolate's threshold (gc_due()).
+
+// Ropes up to this length are copied flat. Most ropes are long chains of
+// short pieces, which are cheaper to copy than to trace, and later reads no
+// longer walk them; longer ropes keep their shape so that pieces they share
+// are not copied over and over.
+#define GC_FLATTEN_LENGTH (1024 * 1024)
+
+static double gc_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static INLINE bool gc_in_range(Heap* heap, GcState* gc, String* string) {
+    return minall_is_value(string) &&
+           (const char*)string >= heap->value_pool + gc->base &&
+           (const char*)string < heap->value_pool + gc->top;
+}
+
+// Address the copy starting at offset will have once moved down
+static INLINE String* gc_final(Heap* heap, GcState* gc, size_t offset) {
+    return (String*)(heap->value_pool + offset - (gc->top - gc->base));
+}
+
+// string_copy() for the collector: a piece that was already copied has a
+// forwarding pointer in place of its characters, so read them from its copy
+// above the top, which is flat because the piece is no longer than the rope
+// being flattened
+static void gc_copy_chars(GcState* gc, String* string, char* dest) {
+    if (string->forwarded) {
+        String* copy = (String*)((char*)string->data.forward + (gc->top - gc->base));
+        memcpy(dest, copy + 1, string->length);
+    } else if (string->is_rope) {
+        gc_copy_chars(gc, string->data.rope.left, dest);
+        gc_copy_chars(gc, string->data.rope.right, dest + string->data.rope.left->length);
+    } else {
+        memcpy(dest, string->data.chars, string->length);
+    }
+}
+
+static String* gc_forward(Heap* heap, GcState* gc, String* string) {
+    if (!gc_in_range(heap, gc, string)) {
+        return string;
+    }
+    if (string->forwarded) {
+        return string->data.forward;
+    }
+
+    size_t offset = heap->value_offset;
+    String* copy;
+    if (string->is_rope && string->length > GC_FLATTEN_LENGTH) {
+        copy = (String*)minall_value_malloc(sizeof(String));
+        *copy = *string;
+    } else {
+        // Short ropes and flattened ropes become ordinary flat strings
+        copy = (String*)minall_value_malloc(sizeof(String) + string->length + 1);
+        copy->length = string->length;
+        copy->is_rope = false;
+        copy->forwarded = false;
+        gc_copy_chars(gc, string, (char*)(copy + 1));
+        ((char*)(copy + 1))[string->length] = '\0';
+        copy->data.chars = (const char*)(gc_final(heap, gc, offset) + 1);
+    }
+
+    string->forwarded = true;
+    string->data.forward = gc_final(heap, gc, offset);
+    return string->data.forward;
+}
+
+void gc_begin(size_t from, bool major) {
+    Heap* heap = &minall_current->heap;
+    GcState* gc = &minall_current->gc;
+    gc->started = gc_now();
+    gc->major = major;
+    gc->base = major || from > heap->value_kept ? from : heap->value_kept;
+    gc->top = heap->value_offset;
+}
+
+bool gc_trace(Value* root) {
+    if (!value_is_string(*root)) {
+        return false;
+    }
+    Heap* heap = &minall_current->heap;
+    GcState* gc = &minall_current->gc;
+    String* string = value_as_string(*root);
+    if (!gc_in_range(heap, gc, string)) {
+        return false;
+    }
+    *root = value_string(gc_forward(heap, gc, string));
+    return true;
+}
+
+void gc_end() {
+    Heap* heap = &minall_current->heap;
+    GcState* gc = &minall_current->gc;
+
+    // Copies are scanned in the order they were made; only rope children
+    // can refer to further strings
+    size_t scan = gc->top;
+    while (scan < heap->value_offset) {
+        String* copy = (String*)(heap->value_pool + scan);
+        if (copy->is_rope) {
+            copy->data.rope.left = gc_forward(heap, gc, copy->data.rope.left);
+            copy->data.rope.right = gc_forward(heap, gc, copy->data.rope.right);
+            scan += sizeof(String);
+        } else {
+            scan += (sizeof(String) + copy->length + 1 + 7) & ~(size_t)7;
+        }
+    }
+
+    size_t live = heap->value_offset - gc->top;
+    memmove(heap->value_pool + gc->base, heap->value_pool + gc->top, live);
+    gc->stats.reclaimed += gc->top - gc->base - live;
+    heap->value_offset = gc->base + live;
+
+    double pause = gc_now() - gc->started;
+    if (pause > gc->stats.max_pause) {
+        gc->stats.max_pause = pause;
+    }
+
+    if (gc->major) {
+        heap->value_kept = 0;
+        gc->threshold = heap->value_offset * 2 > GC_MIN_HEAP ? heap->value_offset * 2 : GC_MIN_HEAP;
+        gc->stats.major_count++;
+        gc->stats.major_seconds += pause;
+    } else {
+        gc->stats.minor_count++;
+        gc->stats.minor_seconds += pause;
+    }
+}
+
+void gc_stats(GcStats* out) {
+    *out = minall_current->gc.stats;
+}
+
+void gc_reset() {
+    minall_current->gc.threshold = GC_MIN_HEAP;
+}
@@ -1,57 +1,78 @@
 #include "minall.h"
 
 static Value execute_block(ASTNode* block, Context* ctx);
+static Value execute_program(ASTNode* program, Context* ctx);
 static Value evaluate_expression(ASTNode* expr, Context* ctx);
 
 Value create_number(double num) {
-    Value value;
-    value.type = VALUE_NUMBER;
-    value.data.number = num;
-    return value;
+    return value_number(num);
 }
 
-Value create_string(const char* str) {
-    Value value;
-    value.type = VALUE_STRING;
-    value.data.string = (char*)minall_malloc(strlen(str) + 1);
-    strcpy(value.data.string, str);
-    return value;
+Value create_undefined() {
+    return value_undefined();
 }
 
-Value create_undefined() {
-    Value value;
-    value.type = VALUE_UNDEFINED;
-    return value;
+Value concat_values(Value left, Value right) {
+    String* l;
+    String* r;
+    
+    if (value_is_string(left) && value_is_string(right)) {
+        l = value_as_string(left);
+        r = value_as_string(right);
+    } else if (value_is_string(left) && value_is_number(right)) {
+        l = value_as_string(left);
+        r = string_from_number(value_as_number(right));
+    } else if (value_is_number(left) && value_is_string(right)) {
+        l = string_from_number(value_as_number(left));
+        r = value_as_string(right);
+    } else {
+        return create_undefined();
+    }
+    
+    return value_string(string_concat(l, r));
 }
 
+// Writes to the current isolate's output
 void print_value(Value value) {
-    switch (value.type) {
+    FILE* out = minall_current->out;
+    switch (value_type(value)) {
         case VALUE_NUMBER:
-            printf("%.2f", value.data.number);
+            fprintf(out, "%.2f", value_as_number(value));
             break;
         case VALUE_STRING:
-            printf("%s", value.data.string);
+            string_print(value_as_string(value), out);
             break;
         case VALUE_FUNCTION:
-            printf("[Function]");
+            fputs("[Function]", out);
             break;
         case VALUE_UNDEFINED:
-            printf("undefined");
+            fputs("undefined", out);
             break;
     }
 }
 
 void init_context(Context* ctx) {
     ctx->var_count = 0;
+    ctx->functions = NULL;
     ctx->func_count = 0;
+    ctx->func_capacity = 0;
+    ctx->frame_count = 0;
+    // Frames use the slot stack of the isolate the context runs in
+    ctx->slots = minall_current->slot_stack;
+    ctx->slot_top = minall_current->slot_stack;
     ctx->has_return = false;
     ctx->return_value = create_undefined();
+    ctx->stored_string = false;
 }
 
+// Name-based access to the global table, for callers outside the resolved
+// program. Compiled code goes through variable_slot instead.
 void set_variable(Context* ctx, const char* name, Value value) {
+    Atom* atom = atom_intern(name, (uint32_t)strlen(name));
+    
     // Check if variable already exists
     for (int i = 0; i < ctx->var_count; i++) {
-        if (strcmp(ctx->variables[i].name, name) == 0) {
+        if (ctx->variables[i].name == atom) {
             ctx->variables[i].value = value;
             return;
         }
@@ -59,125 +80,345 @@ void set_variable(Context* ctx, const char* name, Value value) {
     
     // Add new variable
     if (ctx->var_count < MAX_VARIABLES) {
-        ctx->variables[ctx->var_count].name = (char*)minall_malloc(strlen(name) + 1);
-        strcpy(ctx->variables[ctx->var_count].name, name);
+        ctx->variables[ctx->var_count].name = atom;
         ctx->variables[ctx->var_count].value = value;
         ctx->var_count++;
     }
 }
 
 Value get_variable(Context* ctx, const char* name) {
-    for (int i = 0; i < ctx->var_count; i++) {
-        if (strcmp(ctx->variables[i].name, name) == 0) {
+    Atom* atom = atom_find(name, (uint32_t)strlen(name));
+    
+    for (int i = 0; atom && i < ctx->var_count; i++) {
+        if (ctx->variables[i].name == atom) {
             return ctx->variables[i].value;
         }
     }
     return create_undefined();
 }
 
-static void register_function(Context* ctx, const char* name, char** params, int param_count, ASTNode* body) {
-    if (ctx->func_count < MAX_FUNCTIONS) {
-        ctx->functions[ctx->func_count].name = (char*)minall_malloc(strlen(name) + 1);
-        strcpy(ctx->functions[ctx->func_count].name, name);
-        ctx->functions[ctx->func_count].params = params;
-        ctx->functions[ctx->func_count].param_count = param_count;
-        ctx->functions[ctx->func_count].body = body;
-        ctx->func_count++;
+// A program resolved after a prelude keeps the prelude's globals in their
+// slots, with their values
+static void bind_globals(Context* ctx, ASTNode* program) {
+    int kept = program->data.block.inherited_globals;
+    for (int i = kept; i < program->data.block.global_count && i < MAX_VARIABLES; i++) {
+        ctx->variables[i].name = program->data.block.global_names[i];
+        ctx->variables[i].value = create_undefined();
+    }
+    ctx->var_count = program->data.block.global_count;
+}
+
+static void reserve_functions(Context* ctx, int count) {
+    if (count <= ctx->func_capacity) return;
+    
+    int capacity = ctx->func_capacity ? ctx->func_capacity * 2 : 16;
+    while (capacity < count) capacity *= 2;
+    
+    Function* functions = (Function*)minall_malloc(capacity * sizeof(Function));
+    if (ctx->func_count) {
+        memcpy(functions, ctx->functions, ctx->func_count * sizeof(Function));
     }
+    ctx->functions = functions;
+    ctx->func_capacity = capacity;
 }
 
-static Function* get_function(Context* ctx, const char* name) {
+static Function* get_function(Context* ctx, Atom* name) {
     for (int i = 0; i < ctx->func_count; i++) {
-        if (strcmp(ctx->functions[i].name, name) == 0) {
+        if (ctx->functions[i].name == name) {
             return &ctx->functions[i];
         }
     }
     return NULL;
 }
 
-static Value call_function(Function* func, ASTNode** args, int arg_count, Context* parent_ctx) {
-    // Create new context for function execution
-    Context func_ctx;
-    init_context(&func_ctx);
+// Function definitions live once in the context and are shared by every
+// frame. Resolved declarations are bound by hoist_functions; declarations
+// outside a resolved program fall back to lookup by name when they run.
+static void register_function(Context* ctx, ASTNode* decl) {
+    int index = decl->data.func_decl.function_index;
+    Function* func = index >= 0 && index < ctx->func_count
+        ? &ctx->functions[index]
+        : get_function(ctx, decl->data.func_decl.name);
+    
+    if (!func) {
+        reserve_functions(ctx, ctx->func_count + 1);
+        func = &ctx->functions[ctx->func_count++];
+    }
+    
+    func->name = decl->data.func_decl.name;
+    func->params = decl->data.func_decl.params;
+    func->param_count = decl->data.func_decl.param_count;
+    func->local_count = decl->data.func_decl.local_count;
+    func->body = decl->data.func_decl.body;
+}
+
+// Binds every declaration in the program before it runs, in source order,
+// so a function can be called above its declaration and the last
+// declaration of a name wins - the same binding compile_program gives
+static void hoist_functions(Context* ctx, ASTNode* node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case NODE_FUNCTION_DECLARATION:
+            register_function(ctx, node);
+            hoist_functions(ctx, node->data.func_decl.body);
+            break;
+        case NODE_BLOCK:
+        case NODE_PROGRAM:
+            for (int i = 0; i < node->data.block.count; i++) {
+                hoist_functions(ctx, node->data.block.statements[i]);
+            }
+            break;
+        case NODE_IF:
+            hoist_functions(ctx, node->data.if_stmt.then_branch);
+            hoist_functions(ctx, node->data.if_stmt.else_branch);
+            break;
+        case NODE_WHILE:
+            hoist_functions(ctx, node->data.while_stmt.body);
+            break;
+        case NODE_FOR:
+            hoist_functions(ctx, node->data.for_stmt.body);
+            break;
+        default:
+            break;
+    }
+}
+
+// One entry per function index from resolve_program, bound to the last
+// declaration of its name; entries a prelude declared stay bound unless
+// the program declares them again
+static void bind_functions(Context* ctx, ASTNode* program) {
+    int count = program->data.block.function_count;
+    int kept = program->data.block.inherited_functions;
+    reserve_functions(ctx, count);
+    for (int i = kept; i < count; i++) {
+        memset(&ctx->functions[i], 0, sizeof(Function));
+        ctx->functions[i].name = program->data.block.function_names[i];
+    }
+    ctx->func_count = count;
+    hoist_functions(ctx, program);
+}
+
+// Value regions - run-time strings are allocated in the value arena. Each
+// call and loop iteration is a region that releases what it allocated on
+// exit, unless a string was stored into a variable in the meantime. Loops
+// and calls then compact instead: a minor collection keeps the strings that
+// globals, the current frame or the return value still refer to and
+// releases the rest. A loop only compacts
+// once it has allocated at least as much as survived the last compaction,
+// so the copying stays proportional to what the loop allocates.
+
+#define COMPACT_MIN_BYTES (32 * 1024)
+
+typedef struct {
+    size_t mark;
+    size_t limit;           // compact once value_offset reaches this
+    bool stored_string;     // flag of the enclosing region
+} LoopRegion;
+
+static INLINE bool in_region(Value value, size_t mark) {
+    return value_is_string(value) && minall_is_value(value_as_string(value)) &&
+           (const char*)value_as_string(value) >= minall_current->heap.value_pool + mark;
+}
+
+// Compacts the region opened at mark with a minor collection. Returns how
+// many globals and frame slots still refer to it afterwards.
+static int compact_region(Context* ctx, size_t mark, Value* result, bool globals, bool frame) {
+    int count = 0;
+    gc_begin(mark, false);
+    if (globals) {
+        for (int i = 0; i < ctx->var_count; i++) {
+            count += gc_trace(&ctx->variables[i].value);
+        }
+    }
+    if (frame && ctx->frame_count > 0) {
+        int local_count = ctx->frames[ctx->frame_count - 1].function->local_count;
+        for (int i = 0; i < local_count; i++) {
+            count += gc_trace(&ctx->slots[i]);
+        }
+    }
+    if (result) {
+        gc_trace(result);
+    }
+    gc_end();
+    return count;
+}
+
+static INLINE void store_variable(Context* ctx, int slot, bool is_global, Value value) {
+    *variable_slot(ctx, slot, is_global) = value;
+    if (value_is_string(value) && minall_is_value(value_as_string(value))) {
+        ctx->stored_string = true;
+    }
+}
+
+static INLINE size_t open_region(Context* ctx, bool* stored_string) {
+    *stored_string = ctx->stored_string;
+    ctx->stored_string = false;
+    return minall_mark();
+}
+
+static INLINE void close_region(Context* ctx, size_t mark, bool stored_string) {
+    if (!ctx->stored_string) {
+        minall_release(mark);
+    }
+    ctx->stored_string |= stored_string;
+}
+
+static INLINE void open_loop(Context* ctx, LoopRegion* loop) {
+    loop->mark = open_region(ctx, &loop->stored_string);
+    loop->limit = loop->mark + COMPACT_MIN_BYTES;
+}
+
+// Ends an iteration whose own region was opened at mark
+static INLINE void close_iteration(Context* ctx, LoopRegion* loop, size_t mark, bool stored_string) {
+    close_region(ctx, mark, stored_string);
+    if (ctx->stored_string && UNLIKELY(minall_mark() >= loop->limit)) {
+        ctx->stored_string = compact_region(ctx, loop->mark, NULL, true, true) > 0;
+        size_t live = minall_mark() - loop->mark;
+        loop->limit = minall_mark() + (live > COMPACT_MIN_BYTES ? live : COMPACT_MIN_BYTES);
+    }
+}
+
+static INLINE void close_loop(Context* ctx, LoopRegion* loop) {
+    close_region(ctx, loop->mark, loop->stored_string);
+}
+
+static Value close_call(Context* ctx, size_t mark, bool stored_string, Value result) {
+    // The frame is gone, so only globals and the result can still refer to
+    // the region
+    if (ctx->stored_string) {
+        stored_string |= compact_region(ctx, mark, &result, true, false) > 0;
+    } else if (in_region(result, mark)) {
+        compact_region(ctx, mark, &result, false, false);
+    } else {
+        minall_release(mark);
+    }
+    ctx->stored_string = stored_string;
+    return result;
+}
+
+// Arguments are evaluated onto the slot stack, above every frame, and
+// handed to the native as one array
+static Value call_native(Native* native, ASTNode** args, int arg_count, Context* ctx) {
+    Value* values = ctx->slot_top;
+    if (UNLIKELY(values + arg_count > minall_current->slot_stack + SLOT_STACK_SIZE)) {
+        fprintf(stderr, "Maximum call stack size exceeded in %.*s\n",
+                (int)native->length, native->chars);
+        return create_undefined();
+    }
+    
+    ctx->slot_top = values + arg_count;
+    for (int i = 0; i < arg_count; i++) {
+        values[i] = evaluate_expression(args[i], ctx);
+    }
+    Value result = native->function(values, arg_count, native->data);
+    ctx->slot_top = values;
+    return result;
+}
+
+static Value call_function(Function* func, ASTNode** args, int arg_count, Context* ctx) {
+    Value* caller_slots = ctx->slots;
+    Value* slots = ctx->slot_top;
     
-    // Copy functions from parent context
-    for (int i = 0; i < parent_ctx->func_count; i++) {
-        func_ctx.functions[i] = parent_ctx->functions[i];
+    if (UNLIKELY(ctx->frame_count >= MAX_CALL_STACK ||
+                 slots + func->local_count > minall_current->slot_stack + SLOT_STACK_SIZE)) {
+        fprintf(stderr, "Maximum call stack size exceeded in %.*s\n",
+                (int)func->name->length, func->name->chars);
+        return create_undefined();
     }
-    func_ctx.func_count = parent_ctx->func_count;
     
-    // Bind parameters
-    for (int i = 0; i < func->param_count && i < arg_count; i++) {
-        Value arg_value = evaluate_expression(args[i], parent_ctx);
-        set_variable(&func_ctx, func->params[i], arg_value);
+    // Reserve the frame first so calls made while evaluating arguments
+    // stack above it. Arguments are evaluated in the caller's frame straight
+    // into the param slots; the remaining locals start out undefined.
+    ctx->slot_top = slots + func->local_count;
+    for (int i = 0; i < func->local_count; i++) {
+        slots[i] = i < func->param_count && i < arg_count
+            ? evaluate_expression(args[i], ctx)
+            : create_undefined();
     }
     
-    // Execute function body
-    execute_block(func->body, &func_ctx);
+    Frame* frame = &ctx->frames[ctx->frame_count++];
+    frame->function = func;
+    frame->slots = slots;
+    ctx->slots = slots;
+    
+    bool stored_string;
+    size_t mark = open_region(ctx, &stored_string);
     
-    if (func_ctx.has_return) {
-        return func_ctx.return_value;
+    execute_block(func->body, ctx);
+    
+    ctx->frame_count--;
+    ctx->slots = caller_slots;
+    ctx->slot_top = slots;
+    
+    Value result = create_undefined();
+    if (ctx->has_return) {
+        ctx->has_return = false;
+        result = ctx->return_value;
     }
     
-    return create_undefined();
+    return close_call(ctx, mark, stored_string, result);
 }
 
-static INLINE Value evaluate_binary_op(const char* operator, Value left, Value right) {
+static INLINE Value evaluate_binary_op(BinaryOperator operator, Value left, Value right) {
     // Fast path for number operations - most common case
-    if (LIKELY(left.type == VALUE_NUMBER && right.type == VALUE_NUMBER)) {
-        double l = left.data.number;
-        double r = right.data.number;
-        
-        // Use switch on first character for faster dispatch
-        switch (operator[0]) {
-            case '+': return create_number(l + r);
-            case '-': return create_number(l - r);
-            case '*': return create_number(l * r);
-            case '/': return create_number(LIKELY(r != 0) ? l / r : 0);
-            case '%': return create_number(LIKELY(r != 0) ? (double)((int)l % (int)r) : 0);
-            case '<': 
-                if (operator[1] == '=') return create_number(l <= r ? 1 : 0);
-                return create_number(l < r ? 1 : 0);
-            case '>':
-                if (operator[1] == '=') return create_number(l >= r ? 1 : 0);
-                return create_number(l > r ? 1 : 0);
-            case '=': return create_number(l == r ? 1 : 0);
-            case '!': return create_number(l != r ? 1 : 0);
-        }
+    if (LIKELY(value_is_number(left) && value_is_number(right))) {
+        return create_number(numeric_binary_op(operator, value_as_number(left), value_as_number(right)));
     }
     
     // String concatenation
-    if (strcmp(operator, "+") == 0 && 
-        (left.type == VALUE_STRING || right.type == VALUE_STRING)) {
-        char* result = (char*)minall_malloc(256);
-        
-        if (left.type == VALUE_STRING && right.type == VALUE_STRING) {
-            snprintf(result, 256, "%s%s", left.data.string, right.data.string);
-        } else if (left.type == VALUE_STRING && right.type == VALUE_NUMBER) {
-            snprintf(result, 256, "%s%.2f", left.data.string, right.data.number);
-        } else if (left.type == VALUE_NUMBER && right.type == VALUE_STRING) {
-            snprintf(result, 256, "%.2f%s", left.data.number, right.data.string);
-        }
-        
-        return create_string(result);
+    if (operator == BINARY_ADD && 
+        (value_is_string(left) || value_is_string(right))) {
+        return concat_values(left, right);
     }
     
     return create_undefined();
 }
 
-static Value evaluate_unary_op(const char* operator, Value operand) {
-    if (strcmp(operator, "-") == 0 && operand.type == VALUE_NUMBER) {
-        return create_number(-operand.data.number);
+// Quickening - a generic binary or call node records what it sees for its
+// first QUICKEN_THRESHOLD runs. If it only ever saw one kind, it rewrites
+// itself into a specialized node whose handler guards that assumption. A
+// failed guard deoptimizes the node back to the generic kind for good.
+
+static void record_binary_feedback(ASTNode* node, Value left, Value right) {
+    uint8_t seen = FEEDBACK_OTHER;
+    if (value_is_number(left) && value_is_number(right)) {
+        seen = FEEDBACK_NUMBERS;
+    } else if (node->data.binary_op.operator == BINARY_ADD &&
+               (value_is_string(left) || value_is_string(right))) {
+        seen = FEEDBACK_STRINGS;
+    }
+    node->data.binary_op.feedback |= seen;
+
+    if (++node->data.binary_op.hits < QUICKEN_THRESHOLD) return;
+    if (node->data.binary_op.feedback == FEEDBACK_NUMBERS) {
+        node->type = (NodeType)(NODE_NUMBERS_ADD + node->data.binary_op.operator);
+    } else if (node->data.binary_op.feedback == FEEDBACK_STRINGS) {
+        node->type = NODE_BINARY_CONCAT;
+    }
+}
+
+static void deoptimize_binary(ASTNode* node, uint8_t seen) {
+    node->type = NODE_BINARY_OP;
+    node->data.binary_op.feedback |= seen;
+}
+
+static void record_call_feedback(ASTNode* node, Function* func) {
+    node->data.call.feedback |= func && func->body ? FEEDBACK_NUMBERS : FEEDBACK_OTHER;
+
+    if (++node->data.call.hits < QUICKEN_THRESHOLD) return;
+    if (node->data.call.feedback == FEEDBACK_NUMBERS && node->data.call.target >= 0) {
+        node->type = NODE_CALL_FUNCTION;
+    }
+}
+
+static Value evaluate_unary_op(UnaryOperator operator, Value operand) {
+    if (operator == UNARY_NEG && value_is_number(operand)) {
+        return create_number(-value_as_number(operand));
     }
     
-    if (strcmp(operator, "!") == 0) {
-        bool truthy = false;
-        if (operand.type == VALUE_NUMBER) {
-            truthy = operand.data.number != 0;
-        } else if (operand.type == VALUE_STRING) {
-            truthy = strlen(operand.data.string) > 0;
-        }
-        return create_number(truthy ? 0 : 1);
+    if (operator == UNARY_NOT) {
+        return create_number(is_truthy(operand) ? 0 : 1);
     }
     
     return create_undefined();
@@ -191,14 +432,82 @@ static Value evaluate_expression(ASTNode* expr, Context* ctx) {
             return create_number(expr->data.number);
             
         case NODE_STRING:
-            return create_string(expr->data.string);
+            // Literals are interned and never mutated, so share the atom
+            return value_string(expr->data.string.value);
             
         case NODE_IDENTIFIER:
-            return get_variable(ctx, expr->data.identifier);
+            return *variable_slot(ctx, expr->data.identifier.slot, expr->data.identifier.is_global);
             
         case NODE_BINARY_OP: {
             Value left = evaluate_expression(expr->data.binary_op.left, ctx);
             Value right = evaluate_expression(expr->data.binary_op.right, ctx);
+            if (UNLIKELY(expr->data.binary_op.hits < QUICKEN_THRESHOLD)) {
+                record_binary_feedback(expr, left, right);
+            }
+            return evaluate_binary_op(expr->data.binary_op.operator, left, right);
+        }
+        
+// Quickened number ops; the guard deoptimizes to NODE_BINARY_OP
+#define NUMBERS_CASE(kind, expr_)                                              \
+        case kind: {                                                           \
+            Value left = evaluate_expression(expr->data.binary_op.left, ctx); \
+            Value right = evaluate_expression(expr->data.binary_op.right, ctx); \
+            if (LIKELY(value_is_number(left) && value_is_number(right))) {     \
+                double l = value_as_number(left);                              \
+                double r = value_as_number(right);                             \
+                return create_number(expr_);                                   \
+            }                                                                  \
+            deoptimize_binary(expr, FEEDBACK_OTHER);                           \
+            return evaluate_binary_op(expr->data.binary_op.operator, left, right); \
+        }
+
+        NUMBERS_CASE(NODE_NUMBERS_ADD, l + r)
+        NUMBERS_CASE(NODE_NUMBERS_SUB, l - r)
+        NUMBERS_CASE(NODE_NUMBERS_MUL, l * r)
+        NUMBERS_CASE(NODE_NUMBERS_DIV, LIKELY(r != 0) ? l / r : 0)
+        NUMBERS_CASE(NODE_NUMBERS_MOD, LIKELY(r != 0) ? (double)((int)l % (int)r) : 0)
+        NUMBERS_CASE(NODE_NUMBERS_LT, l < r ? 1 : 0)
+        NUMBERS_CASE(NODE_NUMBERS_LE, l <= r ? 1 : 0)
+        NUMBERS_CASE(NODE_NUMBERS_GT, l > r ? 1 : 0)
+        NUMBERS_CASE(NODE_NUMBERS_GE, l >= r ? 1 : 0)
+        NUMBERS_CASE(NODE_NUMBERS_EQ, l == r ? 1 : 0)
+        NUMBERS_CASE(NODE_NUMBERS_NE, l != r ? 1 : 0)
+        NUMBERS_CASE(NODE_NUMBERS_AND, l != 0 && r != 0 ? 1 : 0)
+        NUMBERS_CASE(NODE_NUMBERS_OR, l != 0 || r != 0 ? 1 : 0)
+#undef NUMBERS_CASE
+        
+        case NODE_BINARY_CONCAT: {
+            Value left = evaluate_expression(expr->data.binary_op.left, ctx);
+            Value right = evaluate_expression(expr->data.binary_op.right, ctx);
+            if (LIKELY(value_is_string(left) || value_is_string(right))) {
+                return concat_values(left, right);
+            }
+            deoptimize_binary(expr, FEEDBACK_OTHER);
+            return evaluate_binary_op(expr->data.binary_op.operator, left, right);
+        }
+        
+        case NODE_BINARY_NUMERIC: {
+            // Both operands are known to produce numbers
+            double l = value_as_number(evaluate_expression(expr->data.binary_op.left, ctx));
+            double r = value_as_number(evaluate_expression(expr->data.binary_op.right, ctx));
+            return create_number(numeric_binary_op(expr->data.binary_op.operator, l, r));
+        }
+        
+        case NODE_BINARY_VAR_CONST: {
+            ASTNode* var = expr->data.binary_op.left;
+            Value left = *variable_slot(ctx, var->data.identifier.slot, var->data.identifier.is_global);
+            double r = expr->data.binary_op.right->data.number;
+            if (LIKELY(value_is_number(left))) {
+                return create_number(numeric_binary_op(expr->data.binary_op.operator, value_as_number(left), r));
+            }
+            return evaluate_binary_op(expr->data.binary_op.operator, left, create_number(r));
+        }
+        
+        case NODE_BINARY_VAR_VAR: {
+            ASTNode* left_var = expr->data.binary_op.left;
+            ASTNode* right_var = expr->data.binary_op.right;
+            Value left = *variable_slot(ctx, left_var->data.identifier.slot, left_var->data.identifier.is_global);
+            Value right = *variable_slot(ctx, right_var->data.identifier.slot, right_var->data.identifier.is_global);
             return evaluate_binary_op(expr->data.binary_op.operator, left, right);
         }
         
@@ -208,38 +517,62 @@ static Value evaluate_expression(ASTNode* expr, Context* ctx) {
         }
         
         case NODE_ASSIGNMENT: {
-            if (expr->data.binary_op.left->type == NODE_IDENTIFIER) {
+            ASTNode* target = expr->data.binary_op.left;
+            if (target->type == NODE_IDENTIFIER) {
                 Value value = evaluate_expression(expr->data.binary_op.right, ctx);
-                set_variable(ctx, expr->data.binary_op.left->data.identifier, value);
+                store_variable(ctx, target->data.identifier.slot, target->data.identifier.is_global, value);
                 return value;
             }
             break;
         }
         
         case NODE_CALL: {
-            if (expr->data.call.function->type == NODE_IDENTIFIER) {
-                const char* func_name = expr->data.call.function->data.identifier;
-                
-                // Built-in functions
-                if (strcmp(func_name, "print") == 0) {
-                    for (int i = 0; i < expr->data.call.arg_count; i++) {
-                        Value arg = evaluate_expression(expr->data.call.args[i], ctx);
-                        print_value(arg);
-                        if (i < expr->data.call.arg_count - 1) printf(" ");
-                    }
-                    printf("\n");
-                    return create_undefined();
-                }
-                
-                // User-defined functions
-                Function* func = get_function(ctx, func_name);
-                if (func) {
-                    return call_function(func, expr->data.call.args, expr->data.call.arg_count, ctx);
+            int target = expr->data.call.target;
+            
+            // Built-in functions
+            if (target == CALL_BUILTIN_PRINT) {
+                for (int i = 0; i < expr->data.call.arg_count; i++) {
+                    Value arg = evaluate_expression(expr->data.call.args[i], ctx);
+                    print_value(arg);
+                    if (i < expr->data.call.arg_count - 1) fputc(' ', minall_current->out);
                 }
+                fputc('\n', minall_current->out);
+                return create_undefined();
+            }
+            if (target <= CALL_NATIVE_BASE) {
+                return call_native(&minall_current->natives[CALL_NATIVE_BASE - target],
+                                   expr->data.call.args, expr->data.call.arg_count, ctx);
+            }
+            
+            // User-defined functions, linked by index; unlinked call sites
+            // look the name up
+            Function* func = NULL;
+            if (LIKELY(target >= 0 && target < ctx->func_count)) {
+                func = &ctx->functions[target];
+            } else if (expr->data.call.function->type == NODE_IDENTIFIER) {
+                func = get_function(ctx, expr->data.call.function->data.identifier.name);
+            }
+            if (UNLIKELY(expr->data.call.hits < QUICKEN_THRESHOLD)) {
+                record_call_feedback(expr, func);
+            }
+            if (func && func->body) {
+                return call_function(func, expr->data.call.args, expr->data.call.arg_count, ctx);
             }
             break;
         }
         
+        case NODE_CALL_FUNCTION: {
+            // Linked call that has always reached a declared function
+            int target = expr->data.call.target;
+            if (LIKELY(target < ctx->func_count && ctx->functions[target].body)) {
+                return call_function(&ctx->functions[target], expr->data.call.args,
+                                     expr->data.call.arg_count, ctx);
+            }
+            expr->type = NODE_CALL;
+            expr->data.call.feedback |= FEEDBACK_OTHER;
+            return evaluate_expression(expr, ctx);
+        }
+        
         default:
             break;
     }
@@ -256,29 +589,22 @@ static Value execute_statement(ASTNode* stmt, Context* ctx) {
             if (stmt->data.var_decl.value) {
                 value = evaluate_expression(stmt->data.var_decl.value, ctx);
             }
-            set_variable(ctx, stmt->data.var_decl.name, value);
+            store_variable(ctx, stmt->data.var_decl.slot, stmt->data.var_decl.is_global, value);
             break;
         }
         
         case NODE_FUNCTION_DECLARATION: {
-            register_function(ctx, stmt->data.func_decl.name, 
-                            stmt->data.func_decl.params,
-                            stmt->data.func_decl.param_count,
-                            stmt->data.func_decl.body);
+            // Resolved declarations were bound when the program started
+            if (stmt->data.func_decl.function_index < 0) {
+                register_function(ctx, stmt);
+            }
             break;
         }
         
         case NODE_IF: {
             Value condition = evaluate_expression(stmt->data.if_stmt.condition, ctx);
-            bool is_truthy = false;
-            
-            if (condition.type == VALUE_NUMBER) {
-                is_truthy = condition.data.number != 0;
-            } else if (condition.type == VALUE_STRING) {
-                is_truthy = strlen(condition.data.string) > 0;
-            }
             
-            if (is_truthy) {
+            if (is_truthy(condition)) {
                 return execute_statement(stmt->data.if_stmt.then_branch, ctx);
             } else if (stmt->data.if_stmt.else_branch) {
                 return execute_statement(stmt->data.if_stmt.else_branch, ctx);
@@ -287,27 +613,63 @@ static Value execute_statement(ASTNode* stmt, Context* ctx) {
         }
         
         case NODE_WHILE: {
-            Value last_value = create_undefined();
+            // Each iteration is a value region, so loops yield undefined
+            // rather than a value that may have been released
+            LoopRegion loop;
+            open_loop(ctx, &loop);
             while (true) {
+                bool stored_string;
+                size_t mark = open_region(ctx, &stored_string);
                 Value condition = evaluate_expression(stmt->data.while_stmt.condition, ctx);
-                bool is_truthy = false;
                 
-                if (condition.type == VALUE_NUMBER) {
-                    is_truthy = condition.data.number != 0;
-                } else if (condition.type == VALUE_STRING) {
-                    is_truthy = strlen(condition.data.string) > 0;
+                if (!is_truthy(condition)) {
+                    close_region(ctx, mark, stored_string);
+                    break;
                 }
                 
-                if (!is_truthy) {
-                    break;
+                execute_statement(stmt->data.while_stmt.body, ctx);
+                if (ctx->has_return) {
+                    // The return value belongs to the enclosing call
+                    ctx->stored_string |= stored_string | loop.stored_string;
+                    return create_undefined();
+                }
+                close_iteration(ctx, &loop, mark, stored_string);
+            }
+            close_loop(ctx, &loop);
+            break;
+        }
+        
+        case NODE_FOR: {
+            // Numeric counted loops run on the FastVM when their variables
+            // hold numbers on entry
+            if (execute_fast_loop(stmt, ctx)) {
+                return create_undefined();
+            }
+            
+            LoopRegion loop;
+            open_loop(ctx, &loop);
+            execute_statement(stmt->data.for_stmt.init, ctx);
+            while (true) {
+                bool stored_string;
+                size_t mark = open_region(ctx, &stored_string);
+                if (stmt->data.for_stmt.condition) {
+                    Value condition = evaluate_expression(stmt->data.for_stmt.condition, ctx);
+                    if (!is_truthy(condition)) {
+                        close_region(ctx, mark, stored_string);
+                        break;
+                    }
                 }
                 
-                last_value = execute_statement(stmt->data.while_stmt.body, ctx);
+                execute_statement(stmt->data.for_stmt.body, ctx);
                 if (ctx->has_return) {
-                    break;
+                    ctx->stored_string |= stored_string | loop.stored_string;
+                    return create_undefined();
                 }
+                evaluate_expression(stmt->data.for_stmt.update, ctx);
+                close_iteration(ctx, &loop, mark, stored_string);
             }
-            return last_value;
+            close_loop(ctx, &loop);
+            break;
         }
         
         case NODE_RETURN: {
@@ -320,11 +682,14 @@ static Value execute_statement(ASTNode* stmt, Context* ctx) {
             return ctx->return_value;
         }
         
-        case NODE_BLOCK:
-        case NODE_PROGRAM: {
+        case NODE_BLOCK: {
             return execute_block(stmt, ctx);
         }
         
+        case NODE_PROGRAM: {
+            return execute_program(stmt, ctx);
+        }
+        
         default: {
             return evaluate_expression(stmt, ctx);
         }
@@ -346,6 +711,33 @@ static Value execute_block(ASTNode* block, Context* ctx) {
     return last_value;
 }
 
+// Between top-level statements no region is open and only the globals
+// refer to values, so that is where major collections run
+static Value execute_program(ASTNode* program, Context* ctx) {
+    Value last_value = create_undefined();
+    
+    for (int i = 0; i < program->data.block.count; i++) {
+        last_value = execute_statement(program->data.block.statements[i], ctx);
+        if (ctx->has_return) {
+            break;
+        }
+        if (UNLIKELY(gc_due())) {
+            gc_begin(0, true);
+            for (int j = 0; j < ctx->var_count; j++) {
+                gc_trace(&ctx->variables[j].value);
+            }
+            gc_trace(&last_value);
+            gc_end();
+        }
+    }
+    
+    return last_value;
+}
+
 Value interpret(ASTNode* node, Context* ctx) {
+    if (node->type == NODE_PROGRAM) {
+        bind_globals(ctx, node);
+        bind_functions(ctx, node);
+    }
     return execute_statement(node, ctx);
 }
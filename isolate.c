@@ -0,0 +1,166 @@
+// pthreads are not part of C99
+#define _GNU_SOURCE
+#include <pthread.h>
+#include "minall.h"
+
+// Isolates
+//
+// An isolate is a whole runtime: its arenas and the atoms, ASTs and values
+// in them, its collector, its global Context and the stacks of both
+// engines. Nothing the engines touch while running a script is shared, so
+// isolates on different threads never contend for anything.
+//
+// The runtime functions work on the isolate the calling thread last entered
+// (minall_current), which saves passing it through every call. A thread
+// enters one isolate at a time and an isolate is entered by one thread at
+// a time; between scripts it can move to another thread.
+//
+// Natives are functions the embedder adds to an isolate. Scripts call them
+// by name like print; resolve_program links each call site to its native
+// by atom, so nothing compares names at run time.
+//
+// minall_run_jobs() spreads independent tasks over a pool of threads, each
+// running its share in an isolate of its own. Workers take the next task
+// index with one atomic add, so the only shared write is that counter.
+
+#define JOB_STACK_SIZE (16 * 1024 * 1024)  // reserved, touched as the walker recurses
+
+MINALL_THREAD_LOCAL MinallIsolate* minall_current = NULL;
+
+// The isolate is large but mostly stacks; calloc maps it fresh, so those
+// pages are only backed once they are used. Call minall_reset() or
+// snapshot_load() in it before the first script.
+MinallIsolate* minall_isolate_new(size_t memory_limit, bool huge_pages) {
+    MinallIsolate* isolate = (MinallIsolate*)calloc(1, sizeof(MinallIsolate));
+    if (!isolate) return NULL;
+
+    minall_heap_init(&isolate->heap, memory_limit, huge_pages);
+    isolate->gc.threshold = GC_MIN_HEAP;
+    isolate->out = stdout;
+    return isolate;
+}
+
+void minall_isolate_enter(MinallIsolate* isolate) {
+    minall_current = isolate;
+}
+
+// Unmaps the isolate's heap; whatever was allocated in it is gone
+void minall_isolate_free(MinallIsolate* isolate) {
+    if (!isolate) return;
+    if (minall_current == isolate) {
+        minall_current = NULL;
+    }
+    minall_heap_free(&isolate->heap);
+    for (int i = 0; i < isolate->native_count; i++) {
+        free(isolate->natives[i].chars);
+    }
+    free(isolate->natives);
+    free(isolate);
+}
+
+// Adds a native to the current isolate, or replaces the one of that name;
+// returns its index, or -1 when out of memory. Call sites resolved before
+// the native was added do not see it.
+int minall_define_native(const char* name, NativeFunction function, void* data) {
+    MinallIsolate* isolate = minall_current;
+    uint32_t length = (uint32_t)strlen(name);
+    Atom* atom = atom_intern(name, length);
+
+    int index = minall_find_native(atom);
+    if (index < 0) {
+        if (isolate->native_count == isolate->native_capacity) {
+            int capacity = isolate->native_capacity ? isolate->native_capacity * 2 : 8;
+            Native* natives = (Native*)realloc(isolate->natives, capacity * sizeof(Native));
+            if (!natives) return -1;
+            isolate->natives = natives;
+            isolate->native_capacity = capacity;
+        }
+        char* chars = (char*)malloc(length);
+        if (!chars) return -1;
+        memcpy(chars, name, length);
+
+        index = isolate->native_count++;
+        isolate->natives[index].name = atom;
+        isolate->natives[index].chars = chars;
+        isolate->natives[index].length = length;
+    }
+    isolate->natives[index].function = function;
+    isolate->natives[index].data = data;
+    return index;
+}
+
+// Index of the native called name in the current isolate, or -1
+int minall_find_native(Atom* name) {
+    MinallIsolate* isolate = minall_current;
+    for (int i = 0; i < isolate->native_count; i++) {
+        if (isolate->natives[i].name == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    void (*task)(int index, void* data);
+    void* data;
+    int count;
+    volatile int next;          // next task index, taken by atomic add
+    size_t memory_limit;        // for the workers' isolates
+    bool huge_pages;
+} JobQueue;
+
+static void* job_worker(void* arg) {
+    JobQueue* queue = (JobQueue*)arg;
+    MinallIsolate* isolate = minall_isolate_new(queue->memory_limit, queue->huge_pages);
+    if (!isolate) {
+        fprintf(stderr, "Error: Out of memory creating an isolate\n");
+        return NULL;
+    }
+    minall_isolate_enter(isolate);
+
+    for (;;) {
+        int index = __sync_fetch_and_add(&queue->next, 1);
+        if (index >= queue->count) break;
+        queue->task(index, queue->data);
+    }
+
+    minall_isolate_free(isolate);
+    return NULL;
+}
+
+// Runs task(index, data) for every index below count on up to jobs
+// threads and waits for all of them. Each thread has its own isolate, with
+// the memory settings of the caller's, current while its tasks run. Returns
+// false if no thread could be started or a worker gave up.
+bool minall_run_jobs(int count, int jobs, void (*task)(int index, void* data), void* data) {
+    JobQueue queue;
+    queue.task = task;
+    queue.data = data;
+    queue.count = count;
+    queue.next = 0;
+    queue.memory_limit = minall_current ? minall_current->heap.limit : MEMORY_LIMIT_DEFAULT;
+    queue.huge_pages = minall_current ? minall_current->heap.huge_pages : false;
+
+    if (jobs > count) jobs = count;
+    if (jobs < 1) return count == 0;
+
+    pthread_t* threads = (pthread_t*)malloc(jobs * sizeof(pthread_t));
+    if (!threads) return false;
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, JOB_STACK_SIZE);
+
+    int started = 0;
+    while (started < jobs &&
+           pthread_create(&threads[started], &attributes, job_worker, &queue) == 0) {
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_attr_destroy(&attributes);
+    free(threads);
+    return started > 0 && queue.next >= count;
+}
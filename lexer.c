@@ -16,165 +16,386 @@ static INLINE bool is_whitespace(char c) {
     return c == ' ' || c == '\t' || c == '\r' || c == '\n';
 }
 
-static TokenType get_keyword_type(const char* word) {
-    if (strcmp(word, "var") == 0) return TOKEN_VAR;
-    if (strcmp(word, "function") == 0) return TOKEN_FUNCTION;
-    if (strcmp(word, "if") == 0) return TOKEN_IF;
-    if (strcmp(word, "else") == 0) return TOKEN_ELSE;
-    if (strcmp(word, "for") == 0) return TOKEN_FOR;
-    if (strcmp(word, "while") == 0) return TOKEN_WHILE;
-    if (strcmp(word, "return") == 0) return TOKEN_RETURN;
+// Run scanners. Each returns the first byte at or after p that ends the
+// run; the terminating NUL always does, so no scan passes the end of the
+// source. skip_whitespace() also advances line and column over the run.
+
+#if defined(MINALL_LEXER_AVX2) || defined(MINALL_LEXER_SSE2)
+
+#if defined(MINALL_LEXER_AVX2)
+#include <immintrin.h>
+
+#define SCAN_WIDTH 32
+#define SCAN_ALL 0xFFFFFFFFu
+
+typedef __m256i ScanBlock;
+
+static INLINE ScanBlock scan_load(const char* block) {
+    return _mm256_load_si256((const __m256i*)block);
+}
+
+// One bit per byte of the block equal to c
+static INLINE uint32_t scan_eq(ScanBlock bytes, char c) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(c)));
+}
+
+// One bit per byte in [low, high]; bytes above 0x7f compare as negative
+static INLINE uint32_t scan_range(ScanBlock bytes, char low, char high) {
+    __m256i above = _mm256_cmpgt_epi8(bytes, _mm256_set1_epi8((char)(low - 1)));
+    __m256i below = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(high + 1)), bytes);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(above, below));
+}
+
+static INLINE ScanBlock scan_lower(ScanBlock bytes) {
+    return _mm256_or_si256(bytes, _mm256_set1_epi8(0x20));
+}
+#else
+#include <emmintrin.h>
+
+#define SCAN_WIDTH 16
+#define SCAN_ALL 0xFFFFu
+
+typedef __m128i ScanBlock;
+
+static INLINE ScanBlock scan_load(const char* block) {
+    return _mm_load_si128((const __m128i*)block);
+}
+
+static INLINE uint32_t scan_eq(ScanBlock bytes, char c) {
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+}
+
+static INLINE uint32_t scan_range(ScanBlock bytes, char low, char high) {
+    __m128i above = _mm_cmpgt_epi8(bytes, _mm_set1_epi8((char)(low - 1)));
+    __m128i below = _mm_cmpgt_epi8(_mm_set1_epi8((char)(high + 1)), bytes);
+    return (uint32_t)_mm_movemask_epi8(_mm_and_si128(above, below));
+}
+
+static INLINE ScanBlock scan_lower(ScanBlock bytes) {
+    return _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+}
+#endif
+
+typedef enum {
+    SCAN_IDENTIFIER,    // stops at the first byte that is not [A-Za-z0-9_]
+    SCAN_STRING,        // stops at the quote, a backslash or NUL
+    SCAN_COMMENT,       // stops at a newline or NUL
+} ScanKind;
+
+// Bits for the bytes of the block that end a run of the given kind
+static INLINE uint32_t scan_stops(ScanBlock bytes, ScanKind kind, char quote) {
+    switch (kind) {
+        case SCAN_IDENTIFIER:
+            // Setting bit 5 folds A-Z onto a-z and moves nothing else there
+            return (scan_range(scan_lower(bytes), 'a', 'z') |
+                    scan_range(bytes, '0', '9') | scan_eq(bytes, '_')) ^ SCAN_ALL;
+        case SCAN_STRING:
+            return scan_eq(bytes, quote) | scan_eq(bytes, '\\') | scan_eq(bytes, '\0');
+        case SCAN_COMMENT:
+            return scan_eq(bytes, '\n') | scan_eq(bytes, '\0');
+    }
+    return SCAN_ALL;
+}
+
+// Loads are aligned, so a block never straddles a page boundary and reading
+// the rest of the block that holds the NUL cannot fault
+static INLINE const char* scan_until(const char* p, ScanKind kind, char quote) {
+    size_t offset = (uintptr_t)p & (SCAN_WIDTH - 1);
+    const char* block = p - offset;
+    uint32_t stops = scan_stops(scan_load(block), kind, quote) >> offset;
+    if (stops) {
+        return p + __builtin_ctz(stops);
+    }
+    for (;;) {
+        block += SCAN_WIDTH;
+        stops = scan_stops(scan_load(block), kind, quote);
+        if (stops) {
+            return block + __builtin_ctz(stops);
+        }
+    }
+}
+
+static INLINE const char* scan_identifier(const char* p) {
+    return scan_until(p, SCAN_IDENTIFIER, 0);
+}
+
+static INLINE const char* scan_string(const char* p, char quote) {
+    return scan_until(p, SCAN_STRING, quote);
+}
+
+static INLINE const char* scan_comment(const char* p) {
+    return scan_until(p, SCAN_COMMENT, 0);
+}
+
+// Newlines in the run are counted from the same blocks; the column restarts
+// after the last one
+static INLINE const char* skip_whitespace(const char* p, int* line, int* column) {
+    size_t offset = (uintptr_t)p & (SCAN_WIDTH - 1);
+    const char* block = p - offset;
+    uint32_t live = (SCAN_ALL << offset) & SCAN_ALL;
+    const char* last_newline = NULL;
+
+    for (;;) {
+        ScanBlock bytes = scan_load(block);
+        uint32_t space = scan_eq(bytes, ' ') | scan_eq(bytes, '\t') |
+                         scan_eq(bytes, '\r') | scan_eq(bytes, '\n');
+        uint32_t stops = (space ^ SCAN_ALL) & live;
+        uint32_t newlines = scan_eq(bytes, '\n') & live;
+        if (stops) {
+            newlines &= (stops & -stops) - 1;
+        }
+        if (newlines) {
+            *line += __builtin_popcount(newlines);
+            last_newline = block + 31 - __builtin_clz(newlines);
+        }
+        if (stops) {
+            const char* end = block + __builtin_ctz(stops);
+            *column = last_newline ? (int)(end - last_newline) : *column + (int)(end - p);
+            return end;
+        }
+        block += SCAN_WIDTH;
+        live = SCAN_ALL;
+    }
+}
+
+#else
+
+static INLINE const char* scan_identifier(const char* p) {
+    while (is_alnum(*p)) p++;
+    return p;
+}
+
+static INLINE const char* scan_string(const char* p, char quote) {
+    while (*p != quote && *p != '\\' && *p != '\0') p++;
+    return p;
+}
+
+static INLINE const char* scan_comment(const char* p) {
+    while (*p != '\n' && *p != '\0') p++;
+    return p;
+}
+
+static INLINE const char* skip_whitespace(const char* p, int* line, int* column) {
+    while (is_whitespace(*p)) {
+        if (*p == '\n') {
+            (*line)++;
+            *column = 1;
+        } else {
+            (*column)++;
+        }
+        p++;
+    }
+    return p;
+}
+
+#endif
+
+// Keywords are classified in place on the source span before anything is
+// interned: switch on length, then on the first character, then compare the
+// remaining bytes. To add a keyword, add one KEYWORD line under its length
+// and first character.
+#define KEYWORD(word, type)                                          \
+    if (memcmp(start + 1, word + 1, sizeof(word) - 2) == 0) return type; \
+    break
+
+static INLINE TokenType get_keyword_type(const char* start, int length) {
+    switch (length) {
+        case 2:
+            switch (start[0]) {
+                case 'i': KEYWORD("if", TOKEN_IF);
+            }
+            break;
+        case 3:
+            switch (start[0]) {
+                case 'f': KEYWORD("for", TOKEN_FOR);
+                case 'v': KEYWORD("var", TOKEN_VAR);
+            }
+            break;
+        case 4:
+            switch (start[0]) {
+                case 'e': KEYWORD("else", TOKEN_ELSE);
+            }
+            break;
+        case 5:
+            switch (start[0]) {
+                case 'w': KEYWORD("while", TOKEN_WHILE);
+            }
+            break;
+        case 6:
+            switch (start[0]) {
+                case 'r': KEYWORD("return", TOKEN_RETURN);
+            }
+            break;
+        case 8:
+            switch (start[0]) {
+                case 'f': KEYWORD("function", TOKEN_FUNCTION);
+            }
+            break;
+    }
     return TOKEN_IDENTIFIER;
 }
 
-Token* tokenize(const char* source, int* token_count) {
-    Token* tokens = (Token*)minall_malloc(MAX_TOKENS * sizeof(Token));
-    int count = 0;
-    int line = 1;
-    int column = 1;
+#undef KEYWORD
+
+TokenType lexer_keyword_type(const char* start, int length) {
+    return get_keyword_type(start, length);
+}
+
+// Decodes the escapes in a string literal body into the pool; the decoded
+// characters are what the atom refers to
+static Atom* intern_escaped(const char* chars, uint32_t length) {
+    char* decoded = (char*)minall_malloc(length);
+    uint32_t count = 0;
     
-    const char* current = source;
+    for (uint32_t i = 0; i < length; i++) {
+        char c = chars[i];
+        if (c == '\\' && i + 1 < length) {
+            c = chars[++i];
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+                default: break;     // \\, \", \' and any other character stand for themselves
+            }
+        }
+        decoded[count++] = c;
+    }
     
-    while (*current != '\0' && count < MAX_TOKENS - 1) {
-        // Skip whitespace - optimized
+    return atom_intern_span(decoded, count);
+}
+
+void lexer_init(Lexer* lexer, const char* source) {
+    lexer->current = source;
+    lexer->line = 1;
+    lexer->column = 1;
+}
+
+// Scans the next token into token; at the end of the source every call
+// returns TOKEN_EOF
+void lexer_next(Lexer* lexer, Token* token) {
+    const char* current = lexer->current;
+    int line = lexer->line;
+    int column = lexer->column;
+    
+    while (*current != '\0') {
         if (LIKELY(is_whitespace(*current))) {
-            if (UNLIKELY(*current == '\n')) {
-                line++;
-                column = 1;
-            } else {
+            // A single space between tokens is the common case
+            if (LIKELY(*current == ' ' && !is_whitespace(current[1]))) {
+                current++;
                 column++;
+            } else {
+                current = skip_whitespace(current, &line, &column);
             }
-            current++;
             continue;
         }
         
         // Skip comments
         if (*current == '/' && *(current + 1) == '/') {
-            while (*current != '\n' && *current != '\0') {
-                current++;
-            }
+            current = scan_comment(current + 2);
             continue;
         }
-        
-        Token* token = &tokens[count++];
-        token->line = line;
-        token->column = column;
-        
+        break;
+    }
+    
+    token->value = NULL;
+    token->line = line;
+    token->column = column;
+    
+    if (*current == '\0') {
+        token->type = TOKEN_EOF;
+    } else if (is_digit(*current)) {
         // Numbers
-        if (is_digit(*current)) {
-            token->type = TOKEN_NUMBER;
-            double num = 0;
-            double fraction = 0;
-            double divisor = 1;
-            bool has_decimal = false;
-            
-            while (is_digit(*current) || (*current == '.' && !has_decimal)) {
-                if (*current == '.') {
-                    has_decimal = true;
-                } else if (!has_decimal) {
-                    num = num * 10 + (*current - '0');
-                } else {
-                    divisor *= 10;
-                    fraction = fraction * 10 + (*current - '0');
-                }
-                current++;
-                column++;
-            }
-            
-            token->number = num + fraction / divisor;
-            continue;
-        }
+        token->type = TOKEN_NUMBER;
+        double num = 0;
+        double fraction = 0;
+        double divisor = 1;
+        bool has_decimal = false;
         
-        // Strings
-        if (*current == '"' || *current == '\'') {
-            char quote = *current;
+        while (is_digit(*current) || (*current == '.' && !has_decimal)) {
+            if (*current == '.') {
+                has_decimal = true;
+            } else if (!has_decimal) {
+                num = num * 10 + (*current - '0');
+            } else {
+                divisor *= 10;
+                fraction = fraction * 10 + (*current - '0');
+            }
             current++;
             column++;
-            
-            char* str_start = (char*)current;
-            int str_len = 0;
-            
-            while (*current != quote && *current != '\0') {
-                str_len++;
-                current++;
-                column++;
-            }
-            
-            if (*current == quote) {
-                current++;
-                column++;
-            }
-            
-            token->type = TOKEN_STRING;
-            token->value = (char*)minall_malloc(str_len + 1);
-            strncpy(token->value, str_start, str_len);
-            token->value[str_len] = '\0';
-            continue;
         }
         
-        // Identifiers and keywords
-        if (is_alpha(*current)) {
-            char* id_start = (char*)current;
-            int id_len = 0;
-            
-            while (is_alnum(*current)) {
-                id_len++;
-                current++;
-                column++;
-            }
-            
-            char* identifier = (char*)minall_malloc(id_len + 1);
-            strncpy(identifier, id_start, id_len);
-            identifier[id_len] = '\0';
-            
-            token->type = get_keyword_type(identifier);
-            token->value = identifier;
-            continue;
-        }
-        
-        // Two-character operators
-        if (*current == '=' && *(current + 1) == '=') {
-            token->type = TOKEN_EQUAL;
-            current += 2;
-            column += 2;
-            continue;
-        }
+        token->number = num + fraction / divisor;
+    } else if (*current == '"' || *current == '\'') {
+        // Strings are views of the source unless they contain an escape
+        char quote = *current;
+        current++;
+        column++;
         
-        if (*current == '!' && *(current + 1) == '=') {
-            token->type = TOKEN_NOT_EQUAL;
-            current += 2;
-            column += 2;
-            continue;
-        }
+        const char* str_start = current;
+        bool has_escape = false;
         
-        if (*current == '<' && *(current + 1) == '=') {
-            token->type = TOKEN_LESS_EQUAL;
+        for (;;) {
+            current = scan_string(current, quote);
+            if (*current != '\\') {
+                break;
+            }
+            if (current[1] == '\0') {
+                current++;
+                break;
+            }
+            has_escape = true;
             current += 2;
-            column += 2;
-            continue;
         }
         
-        if (*current == '>' && *(current + 1) == '=') {
-            token->type = TOKEN_GREATER_EQUAL;
-            current += 2;
-            column += 2;
-            continue;
+        uint32_t str_len = (uint32_t)(current - str_start);
+        column += (int)str_len;
+        if (*current == quote) {
+            current++;
+            column++;
         }
         
-        if (*current == '&' && *(current + 1) == '&') {
-            token->type = TOKEN_AND;
-            current += 2;
-            column += 2;
-            continue;
-        }
+        token->type = TOKEN_STRING;
+        token->value = has_escape ? intern_escaped(str_start, str_len)
+                                  : atom_intern_span(str_start, str_len);
+    } else if (is_alpha(*current)) {
+        // Identifiers and keywords
+        const char* id_start = current;
+        current = scan_identifier(current + 1);
+        int id_len = (int)(current - id_start);
+        column += id_len;
         
-        if (*current == '|' && *(current + 1) == '|') {
-            token->type = TOKEN_OR;
-            current += 2;
-            column += 2;
-            continue;
+        // Keywords carry no atom
+        token->type = get_keyword_type(id_start, id_len);
+        if (token->type == TOKEN_IDENTIFIER) {
+            token->value = atom_intern_span(id_start, id_len);
         }
-        
+    } else if (*current == '=' && *(current + 1) == '=') {
+        // Two-character operators
+        token->type = TOKEN_EQUAL;
+        current += 2;
+        column += 2;
+    } else if (*current == '!' && *(current + 1) == '=') {
+        token->type = TOKEN_NOT_EQUAL;
+        current += 2;
+        column += 2;
+    } else if (*current == '<' && *(current + 1) == '=') {
+        token->type = TOKEN_LESS_EQUAL;
+        current += 2;
+        column += 2;
+    } else if (*current == '>' && *(current + 1) == '=') {
+        token->type = TOKEN_GREATER_EQUAL;
+        current += 2;
+        column += 2;
+    } else if (*current == '&' && *(current + 1) == '&') {
+        token->type = TOKEN_AND;
+        current += 2;
+        column += 2;
+    } else if (*current == '|' && *(current + 1) == '|') {
+        token->type = TOKEN_OR;
+        current += 2;
+        column += 2;
+    } else {
         // Single-character tokens
         switch (*current) {
             case '=': token->type = TOKEN_ASSIGN; break;
@@ -200,11 +421,29 @@ Token* tokenize(const char* source, int* token_count) {
         column++;
     }
     
-    // EOF token
-    tokens[count].type = TOKEN_EOF;
-    tokens[count].line = line;
-    tokens[count].column = column;
-    count++;
+    lexer->current = current;
+    lexer->line = line;
+    lexer->column = column;
+}
+
+// Materializes every token, EOF included, for debugging output. The parser
+// does not use this; it pulls tokens from a Lexer as it goes.
+Token* tokenize(const char* source, int* token_count) {
+    Lexer lexer;
+    Token token;
+    int count = 0;
+    
+    lexer_init(&lexer, source);
+    do {
+        lexer_next(&lexer, &token);
+        count++;
+    } while (token.type != TOKEN_EOF);
+    
+    Token* tokens = (Token*)minall_malloc(count * sizeof(Token));
+    lexer_init(&lexer, source);
+    for (int i = 0; i < count; i++) {
+        lexer_next(&lexer, &tokens[i]);
+    }
     
     *token_count = count;
     return tokens;
@@ -216,7 +455,7 @@ void print_tokens(Token* tokens, int count) {
         if (tokens[i].type == TOKEN_NUMBER) {
             printf(" Number=%.2f", tokens[i].number);
         } else if (tokens[i].value) {
-            printf(" Value=%s", tokens[i].value);
+            printf(" Value=%.*s", (int)tokens[i].value->length, tokens[i].value->chars);
         }
         printf(" Line=%d Column=%d\n", tokens[i].line, tokens[i].column);
     }
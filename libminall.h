@@ -0,0 +1,104 @@
+#ifndef LIBMINALL_H
+#define LIBMINALL_H
+
+// Embedding API for libminall.a / libminall.so
+//
+// Compile a script once and run it as often as needed:
+//
+//     MinallRuntime* runtime = minall_runtime_new(0);
+//     const char* params[] = { "n" };
+//     MinallScript* script = minall_compile(runtime, "return n * 2;", params, 1);
+//     MinallValue arg = minall_number(21);
+//     MinallValue result = minall_run(runtime, script, &arg, 1);   // 42
+//     minall_runtime_free(runtime);
+//
+// A runtime is a whole interpreter with its own heap. It may move between
+// threads but must only be used by one at a time; separate runtimes run in
+// parallel without sharing anything. Running out of the memory limit ends
+// the process, as it does for the minall binary.
+//
+// This header is the whole of the stable interface; nothing else in the
+// library is exported.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MINALL_API_VERSION 1
+
+#if defined(__GNUC__)
+#define MINALL_API __attribute__((visibility("default")))
+#else
+#define MINALL_API
+#endif
+
+typedef struct MinallRuntime MinallRuntime;
+typedef struct MinallScript MinallScript;
+
+typedef enum {
+    MINALL_UNDEFINED,
+    MINALL_NUMBER,
+    MINALL_STRING
+} MinallType;
+
+// A script value. String characters are not NUL-terminated; those handed
+// out by the runtime stay valid until the next call into that runtime.
+typedef struct {
+    MinallType type;
+    double number;
+    const char* chars;
+    size_t length;
+} MinallValue;
+
+// A C function scripts call by name. It must not call back into its own
+// runtime; strings it returns are copied before it is called again.
+typedef MinallValue (*MinallNativeFunction)(MinallRuntime* runtime, const MinallValue* args,
+                                            int arg_count, void* data);
+
+// memory_limit covers the runtime's whole heap, 0 for the default (1 GB);
+// NULL if the runtime could not be created
+MINALL_API MinallRuntime* minall_runtime_new(size_t memory_limit);
+MINALL_API void minall_runtime_free(MinallRuntime* runtime);
+
+// Makes name callable from scripts compiled afterwards, replacing any
+// native of that name and the print builtin; 0 on success, -1 if out of
+// memory
+MINALL_API int minall_register_native(MinallRuntime* runtime, const char* name,
+                                      MinallNativeFunction function, void* data);
+
+// Compiles source; the params are globals the script can read, set from
+// the arguments of each run. The script lives as long as the runtime.
+// Returns NULL, with the error written to stderr, for a syntax error, for
+// a parameter listed twice, or for more variables in one scope than the
+// runtime has slots for.
+MINALL_API MinallScript* minall_compile(MinallRuntime* runtime, const char* source,
+                                        const char* const* params, int param_count);
+
+// Runs script with args bound to its params (missing ones are undefined)
+// and returns what a top-level `return` gave, or undefined. Values from the
+// previous run are freed first.
+MINALL_API MinallValue minall_run(MinallRuntime* runtime, MinallScript* script,
+                                  const MinallValue* args, int arg_count);
+
+static inline MinallValue minall_undefined(void) {
+    MinallValue value = { MINALL_UNDEFINED, 0, NULL, 0 };
+    return value;
+}
+
+static inline MinallValue minall_number(double number) {
+    MinallValue value = { MINALL_NUMBER, number, NULL, 0 };
+    return value;
+}
+
+static inline MinallValue minall_string(const char* chars, size_t length) {
+    MinallValue value = { MINALL_STRING, 0, chars, length };
+    return value;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
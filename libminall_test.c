@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <string.h>
+#include "libminall.h"
+
+// Smoke test of the embedding API, linked against libminall.a and
+// libminall.so by `make lib` and run by `make test`
+
+static int failures = 0;
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,   \
+                    #condition);                                               \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+// Same name as the parser's entry point; linking fails unless the library
+// keeps its internal names to itself
+int parse(void) {
+    return 7;
+}
+
+static int string_is(MinallValue value, const char* chars) {
+    return value.type == MINALL_STRING && value.length == strlen(chars) &&
+           memcmp(value.chars, chars, value.length) == 0;
+}
+
+static MinallValue sum(MinallRuntime* runtime, const MinallValue* args, int arg_count, void* data) {
+    (void)runtime;
+    (*(int*)data)++;
+    double total = 0;
+    for (int i = 0; i < arg_count; i++) {
+        total += args[i].number;
+    }
+    return minall_number(total);
+}
+
+static MinallValue shout(MinallRuntime* runtime, const MinallValue* args, int arg_count, void* data) {
+    (void)runtime;
+    char* buffer = (char*)data;
+    size_t length = 0;
+    if (arg_count > 0 && args[0].type == MINALL_STRING && args[0].length < 63) {
+        memcpy(buffer, args[0].chars, args[0].length);
+        length = args[0].length;
+    }
+    buffer[length++] = '!';
+    return minall_string(buffer, length);
+}
+
+static char printed[256];
+
+static MinallValue capture(MinallRuntime* runtime, const MinallValue* args, int arg_count, void* data) {
+    (void)runtime;
+    (void)data;
+    for (int i = 0; i < arg_count; i++) {
+        size_t used = strlen(printed);
+        if (args[i].type == MINALL_STRING) {
+            snprintf(printed + used, sizeof(printed) - used, "%.*s ", (int)args[i].length, args[i].chars);
+        } else {
+            snprintf(printed + used, sizeof(printed) - used, "%g ", args[i].number);
+        }
+    }
+    return minall_undefined();
+}
+
+static void test_params_and_repeated_runs(void) {
+    MinallRuntime* runtime = minall_runtime_new(0);
+    const char* params[] = { "n", "m" };
+    MinallScript* script = minall_compile(runtime,
+        "function fib(k) { if (k < 2) { return k; } return fib(k - 1) + fib(k - 2); }\n"
+        "return fib(n) + m;", params, 2);
+    CHECK(script != NULL);
+
+    for (int i = 0; i < 1000; i++) {
+        MinallValue args[] = { minall_number(10), minall_number(i) };
+        MinallValue result = minall_run(runtime, script, args, 2);
+        CHECK(result.type == MINALL_NUMBER && result.number == 55 + i);
+    }
+
+    // Missing arguments are undefined, and no return gives undefined
+    MinallScript* silent = minall_compile(runtime, "var x = n;", params, 2);
+    CHECK(minall_run(runtime, silent, NULL, 0).type == MINALL_UNDEFINED);
+    minall_runtime_free(runtime);
+}
+
+static void test_strings(void) {
+    MinallRuntime* runtime = minall_runtime_new(0);
+    const char* params[] = { "name" };
+    MinallScript* script = minall_compile(runtime, "return \"hello \" + name;", params, 1);
+    MinallValue arg = minall_string("world", 5);
+    CHECK(string_is(minall_run(runtime, script, &arg, 1), "hello world"));
+
+    // Long enough to come back as a rope and be flattened
+    MinallScript* repeat = minall_compile(runtime,
+        "var s = \"\"; var i = 0; while (i < 100) { s = s + \"abcdefgh\"; i = i + 1; } return s;",
+        NULL, 0);
+    for (int i = 0; i < 100; i++) {
+        MinallValue result = minall_run(runtime, repeat, NULL, 0);
+        CHECK(result.type == MINALL_STRING && result.length == 800 &&
+              memcmp(result.chars + 792, "abcdefgh", 8) == 0);
+    }
+    minall_runtime_free(runtime);
+}
+
+static void test_natives(void) {
+    MinallRuntime* runtime = minall_runtime_new(0);
+    int calls = 0;
+    char buffer[64];
+    CHECK(minall_register_native(runtime, "sum", sum, &calls) == 0);
+    CHECK(minall_register_native(runtime, "shout", shout, buffer) == 0);
+    CHECK(minall_register_native(runtime, "print", capture, NULL) == 0);
+
+    const char* params[] = { "x" };
+    MinallScript* script = minall_compile(runtime,
+        "print(sum(x, 2, 3), shout(\"hi\"));\n"
+        "return shout(\"v\" + sum(x));", params, 1);
+    CHECK(script != NULL);
+    MinallValue arg = minall_number(1);
+    CHECK(string_is(minall_run(runtime, script, &arg, 1), "v1.00!"));
+    CHECK(calls == 2);
+    CHECK(strcmp(printed, "6 hi! ") == 0);
+    minall_runtime_free(runtime);
+}
+
+// A script whose own stack would not fit is refused rather than run
+static void test_stack_limit(void) {
+    MinallRuntime* runtime = minall_runtime_new(0);
+    int calls = 0;
+    CHECK(minall_register_native(runtime, "sum", sum, &calls) == 0);
+
+    static char source[64 * 1024];
+    size_t used = (size_t)snprintf(source, sizeof(source), "return sum(1");
+    for (int i = 1; i < 20000; i++) {
+        used += (size_t)snprintf(source + used, sizeof(source) - used, ",1");
+    }
+    snprintf(source + used, sizeof(source) - used, ");");
+    MinallScript* script = minall_compile(runtime, source, NULL, 0);
+    CHECK(script != NULL);
+    CHECK(minall_run(runtime, script, NULL, 0).type == MINALL_UNDEFINED);
+    CHECK(calls == 0);
+
+    MinallScript* small = minall_compile(runtime, "return sum(1, 2);", NULL, 0);
+    CHECK(minall_run(runtime, small, NULL, 0).number == 3);
+    minall_runtime_free(runtime);
+}
+
+static void test_two_runtimes(void) {
+    MinallRuntime* first = minall_runtime_new(0);
+    MinallRuntime* second = minall_runtime_new(16 << 20);
+    const char* params[] = { "n" };
+    MinallScript* double_it = minall_compile(first, "return n * 2;", params, 1);
+    MinallScript* square_it = minall_compile(second, "return n * n;", params, 1);
+    for (int i = 0; i < 10; i++) {
+        MinallValue arg = minall_number(i);
+        CHECK(minall_run(first, double_it, &arg, 1).number == i * 2);
+        CHECK(minall_run(second, square_it, &arg, 1).number == i * i);
+    }
+    minall_runtime_free(first);
+    minall_runtime_free(second);
+}
+
+static void test_compile_errors(void) {
+    MinallRuntime* runtime = minall_runtime_new(0);
+    const char* params[] = { "a", "a" };
+    CHECK(minall_compile(runtime, "return a;", params, 2) == NULL);
+
+    // Each stops at a token the parser cannot use
+    CHECK(minall_compile(runtime, "print(1 + ;", NULL, 0) == NULL);
+    CHECK(minall_compile(runtime, "var = 3;", NULL, 0) == NULL);
+    CHECK(minall_compile(runtime, "function f(a b) { return a; }", NULL, 0) == NULL);
+    CHECK(minall_compile(runtime, "if (1 { print(1); }", NULL, 0) == NULL);
+    CHECK(minall_compile(runtime, "while (1) { print(1);", NULL, 0) == NULL);
+    CHECK(minall_compile(runtime, "x = (1 + 2;", NULL, 0) == NULL);
+    CHECK(minall_compile(runtime, "@", NULL, 0) == NULL);
+
+    // One variable more than a scope has slots for, at the top level and
+    // in a function
+    static char source[16 * 1024];
+    for (int in_function = 0; in_function < 2; in_function++) {
+        size_t used = (size_t)snprintf(source, sizeof(source), "%s", in_function ? "function f() {" : "");
+        for (int i = 0; i <= 1000; i++) {
+            used += (size_t)snprintf(source + used, sizeof(source) - used, "var v%d = %d;", i, i);
+        }
+        snprintf(source + used, sizeof(source) - used, "%s", in_function ? "return v0; }" : "");
+        CHECK(minall_compile(runtime, source, NULL, 0) == NULL);
+    }
+
+    // The runtime is still usable afterwards
+    MinallScript* script = minall_compile(runtime, ";; return a + 1;", params, 1);
+    MinallValue arg = minall_number(1);
+    CHECK(script != NULL && minall_run(runtime, script, &arg, 1).number == 2);
+    minall_runtime_free(runtime);
+}
+
+int main(void) {
+    test_params_and_repeated_runs();
+    test_strings();
+    test_natives();
+    test_stack_limit();
+    test_two_runtimes();
+    test_compile_errors();
+    CHECK(parse() == 7);
+
+    if (failures) {
+        fprintf(stderr, "libminall: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("libminall: all checks passed\n");
+    return 0;
+}
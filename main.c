@@ -1,99 +1,469 @@
+// mmap, MAP_POPULATE, madvise, fileno, clock_gettime and open_memstream
+// are not part of C99
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "minall.h"
 
-static char* read_file(const char* filename) {
+// Script text as the lexer sees it: NUL-terminated and, since atoms borrow
+// spans of it, alive until the program is done with.
+//
+// Regular files are mapped read-only and lexed in place. The mapping is
+// placed over an anonymous reservation one byte longer than the file, so
+// the byte after the last one is always a mapped zero even when the file
+// ends on a page boundary. Pipes, stdin ("-") and anything that cannot be
+// mapped are read into a malloc'd buffer instead.
+typedef struct {
+    const char* chars;
+    size_t length;
+    size_t mapped;      // bytes mapped, 0 when chars is malloc'd
+} Source;
+
+static bool populate_source = false;
+
+#define SOURCE_READ_CHUNK (64 * 1024)
+
+static bool read_stream(FILE* file, const char* filename, Source* source) {
+    size_t capacity = SOURCE_READ_CHUNK;
+    size_t length = 0;
+    char* content = (char*)malloc(capacity);
+    
+    while (content) {
+        if (capacity - length < SOURCE_READ_CHUNK + 1) {
+            capacity *= 2;
+            char* grown = (char*)realloc(content, capacity);
+            if (!grown) break;
+            content = grown;
+        }
+        size_t count = fread(content + length, 1, SOURCE_READ_CHUNK, file);
+        length += count;
+        if (count < SOURCE_READ_CHUNK) {
+            if (ferror(file)) {
+                fprintf(stderr, "Error: Could not read file %s\n", filename);
+                free(content);
+                return false;
+            }
+            content[length] = '\0';
+            source->chars = content;
+            source->length = length;
+            source->mapped = 0;
+            return true;
+        }
+    }
+    
+    free(content);
+    fprintf(stderr, "Error: Out of memory reading file %s\n", filename);
+    return false;
+}
+
+static bool map_file(int fd, size_t length, Source* source) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mapped = (length + 1 + page - 1) & ~(page - 1);
+    
+    char* base = (char*)mmap(NULL, mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    if (length > 0) {
+        int flags = MAP_PRIVATE | MAP_FIXED;
+#ifdef MAP_POPULATE
+        if (populate_source) {
+            flags |= MAP_POPULATE;
+        }
+#endif
+        if (mmap(base, length, PROT_READ, flags, fd, 0) == MAP_FAILED) {
+            munmap(base, mapped);
+            return false;
+        }
+        // The lexer makes one pass front to back
+        madvise(base, length, MADV_SEQUENTIAL);
+    }
+    
+    source->chars = base;
+    source->length = length;
+    source->mapped = mapped;
+    return true;
+}
+
+static bool load_source(const char* filename, Source* source) {
+    if (strcmp(filename, "-") == 0) {
+        return read_stream(stdin, "<stdin>", source);
+    }
+    
     FILE* file = fopen(filename, "r");
     if (!file) {
         fprintf(stderr, "Error: Could not open file %s\n", filename);
-        return NULL;
+        return false;
     }
     
-    fseek(file, 0, SEEK_END);
-    long size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    char* content = (char*)malloc(size + 1);
-    fread(content, 1, size, file);
-    content[size] = '\0';
+    struct stat info;
+    bool loaded = fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode) &&
+                  map_file(fileno(file), (size_t)info.st_size, source);
+    if (!loaded) {
+        loaded = read_stream(file, filename, source);
+    }
     
     fclose(file);
-    return content;
+    return loaded;
+}
+
+static void unload_source(Source* source) {
+    if (source->mapped) {
+        munmap((void*)source->chars, source->mapped);
+    } else {
+        free((void*)source->chars);
+    }
+}
+
+// Parse, pulling tokens from the lexer as it goes, and run the static passes;
+// a script that runs after a restored prelude is resolved against it. NULL
+// after a syntax or resolve error.
+static ASTNode* parse_script(const char* source, ASTNode* prelude, bool optimize) {
+    ASTNode* ast = parse(source);
+    if (!ast || !resolve_program_after(ast, prelude)) return NULL;
+    if (optimize) {
+        optimize_program(ast);
+    }
+    return ast;
+}
+
+// CPU time of the calling thread, which is all of the process's outside
+// of --jobs
+static double cpu_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
 }
 
-static void execute_file(const char* filename) {
-    char* source = read_file(filename);
-    if (!source) return;
+// Runs a script in the current isolate, reporting to its output; false if
+// it could not be run
+static bool execute_file(const char* filename, bool use_vm, bool optimize, bool use_cache,
+                         const char* snapshot) {
+    Source source;
+    if (!load_source(filename, &source)) return false;
+    
+    FILE* out = minall_current->out;
+    fprintf(out, "Executing %s...\n", filename);
+    
+    double start = cpu_seconds();
+    
+    // Reset memory pool, or map back the heap and globals a prelude left
+    ASTNode* prelude = NULL;
+    Context* ctx = &minall_current->context;
+    if (snapshot) {
+        if (!snapshot_load(snapshot, &prelude, ctx)) {
+            unload_source(&source);
+            return false;
+        }
+    } else {
+        minall_reset();
+        init_context(ctx);
+    }
+    
+    if (use_vm) {
+        // Run the cached bytecode for this source if there is any, otherwise
+        // compile it and leave a cache file for the next run
+        uint64_t hash = use_cache ? cache_hash(source.chars, source.length) : 0;
+        char* path = use_cache ? cache_path(filename, hash, optimize) : NULL;
+        BytecodeProgram* program = path ? cache_load(path, hash, source.length, optimize) : NULL;
+        if (!program) {
+            ASTNode* ast = parse_script(source.chars, NULL, optimize);
+            if (!ast) {
+                free(path);
+                unload_source(&source);
+                return false;
+            }
+            program = compile_program(ast);
+            if (path) {
+                cache_write(path, program, hash, source.length, optimize);
+            }
+        }
+        vm_execute(program, NULL, 0);
+        cache_release(program);
+        free(path);
+    } else {
+        // Interpret
+        ASTNode* ast = parse_script(source.chars, prelude, optimize);
+        if (!ast) {
+            unload_source(&source);
+            return false;
+        }
+        interpret(ast, ctx);
+    }
+    
+    double execution_time = cpu_seconds() - start;
     
-    printf("Executing %s...\n", filename);
+    fprintf(out, "Execution completed in %.6f seconds\n", execution_time);
+    fprintf(out, "Memory used: %zu bytes (peak %zu bytes)\n", minall_memory_used(), minall_memory_peak());
     
-    clock_t start = clock();
+    unload_source(&source);
+    return true;
+}
+
+// Writes the cache file for a script without running it; false if no
+// cache file was written
+static bool compile_file(const char* filename, bool optimize) {
+    Source source;
+    if (!load_source(filename, &source)) return false;
     
-    // Reset memory pool
     minall_reset();
+    uint64_t hash = cache_hash(source.chars, source.length);
+    char* path = cache_path(filename, hash, optimize);
+    ASTNode* ast = path ? parse_script(source.chars, NULL, optimize) : NULL;
+    bool ok = false;
+    if (!path) {
+        fprintf(stderr, "Error: No cache location for %s; set MINALL_CACHE_DIR\n", filename);
+    } else if (!ast) {
+        // The syntax error has been reported
+    } else if (cache_write(path, compile_program(ast), hash, source.length, optimize)) {
+        printf("Compiled %s to %s\n", filename, path);
+        ok = true;
+    } else {
+        fprintf(stderr, "Error: Could not write cache file %s\n", path);
+    }
     
-    // Tokenize
-    int token_count;
-    Token* tokens = tokenize(source, &token_count);
+    free(path);
+    unload_source(&source);
+    return ok;
+}
+
+// Runs a prelude script and saves the heap and globals it leaves behind;
+// false if no snapshot was written
+static bool snapshot_file(const char* filename, const char* snapshot, bool optimize) {
+    Source source;
+    if (!load_source(filename, &source)) return false;
     
-    // Parse
-    ASTNode* ast = parse(tokens, token_count);
+    // Atoms borrow their characters from the source, so it has to be in the
+    // heap to be saved with it
+    minall_reset();
+    char* chars = (char*)minall_malloc(source.length + 1);
+    memcpy(chars, source.chars, source.length + 1);
+    unload_source(&source);
     
-    // Interpret
-    Context ctx;
-    init_context(&ctx);
-    interpret(ast, &ctx);
+    ASTNode* ast = parse_script(chars, NULL, optimize);
+    if (!ast) return false;
+    Context* ctx = &minall_current->context;
+    init_context(ctx);
+    interpret(ast, ctx);
     
-    clock_t end = clock();
-    double execution_time = ((double)(end - start)) / CLOCKS_PER_SEC;
+    if (!snapshot_write(snapshot, ast, ctx)) {
+        return false;
+    }
+    printf("Snapshot of %s written to %s\n", filename, snapshot);
+    return true;
+}
+
+// Scripts run by --jobs; each one prints into a buffer of its own, and the
+// buffers are written out in order once all scripts are done
+typedef struct {
+    char** scripts;
+    char** outputs;
+    size_t* output_sizes;
+    bool use_vm;
+    bool optimize;
+    bool use_cache;
+    volatile int failures;      // scripts that could not be run, by atomic add
+} ScriptBatch;
+
+static void run_batch_script(int index, void* data) {
+    ScriptBatch* batch = (ScriptBatch*)data;
+    FILE* out = open_memstream(&batch->outputs[index], &batch->output_sizes[index]);
+    if (!out) {
+        fprintf(stderr, "Error: Out of memory running %s\n", batch->scripts[index]);
+        __sync_fetch_and_add(&batch->failures, 1);
+        return;
+    }
+    minall_current->out = out;
+    if (!execute_file(batch->scripts[index], batch->use_vm, batch->optimize, batch->use_cache, NULL)) {
+        __sync_fetch_and_add(&batch->failures, 1);
+    }
+    minall_current->out = stdout;
+    fclose(out);
+}
+
+// False if any script could not be run
+static bool run_batch(char** scripts, int count, int jobs, bool use_vm, bool optimize, bool use_cache) {
+    ScriptBatch batch;
+    batch.scripts = scripts;
+    batch.outputs = (char**)calloc(count, sizeof(char*));
+    batch.output_sizes = (size_t*)calloc(count, sizeof(size_t));
+    batch.use_vm = use_vm;
+    batch.optimize = optimize;
+    batch.use_cache = use_cache;
+    batch.failures = 0;
     
-    printf("Execution completed in %.6f seconds\n", execution_time);
-    printf("Memory used: %zu bytes\n", memory_offset);
+    bool ok = batch.outputs && batch.output_sizes &&
+              minall_run_jobs(count, jobs, run_batch_script, &batch);
+    if (!ok) {
+        fprintf(stderr, "Error: Could not start %d jobs\n", jobs);
+    }
     
-    free(source);
+    for (int i = 0; batch.outputs && i < count; i++) {
+        if (batch.outputs[i]) {
+            fwrite(batch.outputs[i], 1, batch.output_sizes[i], stdout);
+            free(batch.outputs[i]);
+        }
+    }
+    free(batch.outputs);
+    free(batch.output_sizes);
+    return ok && batch.failures == 0;
 }
 
 int main(int argc, char* argv[]) {
-    printf("MinAll JavaScript Runtime v1.0\n");
+    printf("MinAll JavaScript Runtime v" MINALL_VERSION "\n");
     printf("High-speed minimal JavaScript runtime in C\n\n");
     
     if (argc < 2) {
-        printf("Usage: %s <script.js> [options]\n", argv[0]);
+        printf("Usage: %s <script.js | -> [more scripts] [options]\n", argv[0]);
         printf("Options:\n");
         printf("  --benchmark  Run performance benchmarks\n");
+        printf("  --tokens     Print tokens for debugging\n");
         printf("  --ast        Print AST for debugging\n");
+        printf("  --bytecode   Print compiled bytecode for debugging\n");
+        printf("  --vm         Execute on the bytecode VM, cached next to the script\n");
+        printf("               or in $MINALL_CACHE_DIR\n");
+        printf("  --compile-only  Write the bytecode cache file and exit\n");
+        printf("  --no-cache   Neither read nor write the bytecode cache\n");
+        printf("  --no-opt     Skip AST optimizations (constant folding etc.)\n");
+        printf("  --memory-limit=MB  Cap each isolate's heap (default %zu MB)\n", MEMORY_LIMIT_DEFAULT >> 20);
+        printf("  --huge-pages Back the heap with huge pages where available\n");
+        printf("  --populate   Fault the whole script in before lexing starts\n");
+        printf("  --snapshot=FILE       Run the script as a prelude and save its heap\n");
+        printf("  --from-snapshot=FILE  Restore a prelude's heap, then run the script\n");
+        printf("  --jobs=N     Run the scripts N at a time, each in an isolate of its own\n");
+        printf("               (with --benchmark: threads for the isolate test)\n");
         return 1;
     }
     
     bool run_benchmark = false;
+    bool show_tokens = false;
     bool show_ast = false;
+    bool show_bytecode = false;
+    bool use_vm = false;
+    bool optimize = true;
+    bool compile_only = false;
+    bool use_cache = true;
+    const char* snapshot_out = NULL;
+    const char* snapshot_in = NULL;
+    size_t memory_limit = MEMORY_LIMIT_DEFAULT;
+    bool huge_pages = false;
+    int jobs = 0;
+    
+    // Options may follow the scripts; every other argument is a script
+    char** scripts = argv + 1;
+    int script_count = 1;
     
     for (int i = 2; i < argc; i++) {
         if (strcmp(argv[i], "--benchmark") == 0) {
             run_benchmark = true;
+        } else if (strcmp(argv[i], "--tokens") == 0) {
+            show_tokens = true;
         } else if (strcmp(argv[i], "--ast") == 0) {
             show_ast = true;
+        } else if (strcmp(argv[i], "--bytecode") == 0) {
+            show_bytecode = true;
+        } else if (strcmp(argv[i], "--vm") == 0) {
+            use_vm = true;
+        } else if (strcmp(argv[i], "--no-opt") == 0) {
+            optimize = false;
+        } else if (strncmp(argv[i], "--memory-limit=", 15) == 0) {
+            memory_limit = (size_t)atol(argv[i] + 15) << 20;
+        } else if (strcmp(argv[i], "--huge-pages") == 0) {
+            huge_pages = true;
+        } else if (strcmp(argv[i], "--populate") == 0) {
+            populate_source = true;
+        } else if (strcmp(argv[i], "--compile-only") == 0) {
+            compile_only = true;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            use_cache = false;
+        } else if (strncmp(argv[i], "--snapshot=", 11) == 0) {
+            snapshot_out = argv[i] + 11;
+        } else if (strncmp(argv[i], "--from-snapshot=", 16) == 0) {
+            snapshot_in = argv[i] + 16;
+        } else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            jobs = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "--", 2) != 0) {
+            scripts[script_count++] = argv[i];
         }
     }
     
+    // The main thread runs in an isolate like any --jobs worker
+    MinallIsolate* isolate = minall_isolate_new(memory_limit, huge_pages);
+    if (!isolate) {
+        fprintf(stderr, "Error: Out of memory creating an isolate\n");
+        return 1;
+    }
+    minall_isolate_enter(isolate);
+    
     if (run_benchmark) {
-        run_performance_tests();
+        run_performance_tests(optimize, jobs);
+        return 0;
+    }
+    
+    if (script_count > 1 || jobs > 0) {
+        if (snapshot_out || snapshot_in || compile_only || show_tokens || show_ast || show_bytecode) {
+            fprintf(stderr, "Error: Several scripts or --jobs only combine with options for running\n");
+            return 1;
+        }
+        return run_batch(scripts, script_count, jobs > 0 ? jobs : 1, use_vm, optimize, use_cache) ? 0 : 1;
+    }
+    
+    if ((snapshot_out || snapshot_in) && use_vm) {
+        fprintf(stderr, "Error: Snapshots hold tree-walker state and cannot be used with --vm\n");
+        return 1;
+    }
+    
+    if (snapshot_out && snapshot_in) {
+        fprintf(stderr, "Error: --snapshot and --from-snapshot cannot be combined\n");
+        return 1;
+    }
+    
+    if (snapshot_out) {
+        return snapshot_file(argv[1], snapshot_out, optimize) ? 0 : 1;
+    }
+    
+    if (compile_only) {
+        return compile_file(argv[1], optimize) ? 0 : 1;
+    }
+    
+    if (show_tokens) {
+        Source source;
+        if (!load_source(argv[1], &source)) return 1;
+        minall_reset();
+        int token_count;
+        Token* tokens = tokenize(source.chars, &token_count);
+        printf("Tokens for %s:\n", argv[1]);
+        print_tokens(tokens, token_count);
+        unload_source(&source);
         return 0;
     }
     
     if (show_ast) {
-        char* source = read_file(argv[1]);
-        if (source) {
-            minall_reset();
-            int token_count;
-            Token* tokens = tokenize(source, &token_count);
-            ASTNode* ast = parse(tokens, token_count);
+        Source source;
+        if (!load_source(argv[1], &source)) return 1;
+        minall_reset();
+        ASTNode* ast = parse(source.chars);
+        if (ast) {
             printf("AST for %s:\n", argv[1]);
             print_ast(ast, 0);
-            free(source);
         }
-        return 0;
+        unload_source(&source);
+        return ast ? 0 : 1;
     }
     
-    execute_file(argv[1]);
+    if (show_bytecode) {
+        Source source;
+        if (!load_source(argv[1], &source)) return 1;
+        minall_reset();
+        ASTNode* ast = parse_script(source.chars, NULL, optimize);
+        if (ast) {
+            printf("Bytecode for %s:\n", argv[1]);
+            print_bytecode(compile_program(ast));
+        }
+        unload_source(&source);
+        return ast ? 0 : 1;
+    }
     
-    return 0;
+    return execute_file(argv[1], use_vm, optimize, use_cache, snapshot_in) ? 0 : 1;
 }
@@ -1,22 +1,372 @@
+// mmap, MAP_ANONYMOUS and the huge page flags are not part of C99
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <unistd.h>
 #include "minall.h"
 
-char memory_pool[MEMORY_POOL_SIZE];
-size_t memory_offset = 0;
+// Two bump arenas, both mapped from the OS on demand and bounded together
+// by the memory limit.
+//
+// The compile arena holds what the front end builds - tokens, atoms, the
+// AST, bytecode - and lives until minall_reset(). It is a chain of chunks:
+// when the current chunk is full a new one is mapped, so a large script
+// grows the heap instead of running out of it. minall_reset() unmaps every
+// chunk but the first, which stays mapped (and its pages warm) for the next
+// script.
+//
+// The value arena holds run-time values (strings) and can also be rolled
+// back to a mark: the tree walker opens a region around each call and loop
+// iteration and releases it unless a value allocated there escaped.
+// Regions are compacted by moving memory, so this arena must be contiguous;
+// it is one address range the size of the limit, reserved up front and
+// backed by pages only as they are touched.
+//
+// With huge pages enabled, chunks are mapped with MAP_HUGETLB when the
+// system has huge pages reserved, and otherwise advised MADV_HUGEPAGE so
+// transparent huge pages can back them.
+//
+// Each isolate has its own heap. The first one sits at fixed addresses
+// when the address space allows it: chunks one after another from
+// HEAP_ADDRESS, the value arena one memory limit above. A heap saved by
+// minall_heap_state() can then be mapped back by minall_heap_restore() in
+// another process with every pointer in it still valid (see snapshot.c).
+// If an address is taken, that mapping goes wherever the kernel puts it and
+// the heap can no longer be saved; the heaps of further isolates are placed
+// by the kernel from the start.
+
+#define HEAP_ADDRESS ((uintptr_t)0x200000000000)
+
+typedef struct MemoryChunk {
+    struct MemoryChunk* next;   // the chunk filled before this one
+    size_t size;                // mapped bytes, header included
+} MemoryChunk;
+
+#define CHUNK_HEADER ((sizeof(MemoryChunk) + 7) & ~(size_t)7)
+
+// Only one heap at a time can have the fixed address; the others are
+// placed by the kernel
+static volatile int heap_address_taken = 0;
+
+static void memory_exhausted(Heap* heap, size_t size) {
+    fprintf(stderr, "Memory limit of %zu bytes exceeded allocating %zu bytes\n",
+            heap->limit, size);
+    exit(1);
+}
+
+// For sizes known to be too large before anything is allocated, such as
+// a string longer than the value arena could ever flatten
+void minall_out_of_memory(size_t size) {
+    memory_exhausted(&minall_current->heap, size);
+}
+
+static void advise_huge_pages(Heap* heap, void* ptr, size_t size) {
+#ifdef MADV_HUGEPAGE
+    if (heap->huge_pages) {
+        madvise(ptr, size, MADV_HUGEPAGE);
+    }
+#else
+    (void)heap;
+    (void)ptr;
+    (void)size;
+#endif
+}
+
+// Maps anonymous memory at address if it is free; kernels without
+// MAP_FIXED_NOREPLACE take it as a hint, so the result is checked either way
+static void* map_at(uintptr_t address, size_t size, int flags) {
+#ifdef MAP_FIXED_NOREPLACE
+    flags |= MAP_FIXED_NOREPLACE;
+#endif
+    void* ptr = mmap((void*)address, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (ptr != MAP_FAILED && (uintptr_t)ptr != address) {
+        munmap(ptr, size);
+        ptr = MAP_FAILED;
+    }
+    return ptr;
+}
+
+// offset is where the mapping goes relative to the heap's address
+static void* map_anywhere(Heap* heap, size_t offset, size_t size, int flags) {
+    void* ptr = heap->fixed ? map_at(heap->address + offset, size, flags) : MAP_FAILED;
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+        heap->fixed = false;
+    }
+    return ptr;
+}
+
+// size is a multiple of MEMORY_CHUNK_SIZE, which is also a whole number of
+// huge pages; chunks are placed end to end, so the next one goes at the
+// mapped size
+static void* map_chunk(Heap* heap, size_t size) {
+    void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (heap->huge_pages) {
+        ptr = heap->fixed
+            ? map_at(heap->address + heap->mapped, size, MAP_HUGETLB)
+            : mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (ptr == MAP_FAILED) {
+        ptr = map_anywhere(heap, heap->mapped, size, 0);
+        if (ptr == MAP_FAILED) {
+            return NULL;
+        }
+        advise_huge_pages(heap, ptr, size);
+    }
+    return ptr;
+}
+
+static void* chunk_malloc(Heap* heap, size_t size) {
+    size_t chunk_size = (CHUNK_HEADER + size + MEMORY_CHUNK_SIZE - 1) & ~(size_t)(MEMORY_CHUNK_SIZE - 1);
+    if (heap->mapped + heap->value_end + chunk_size > heap->limit) {
+        memory_exhausted(heap, size);
+    }
+
+    MemoryChunk* chunk = (MemoryChunk*)map_chunk(heap, chunk_size);
+    if (!chunk) {
+        memory_exhausted(heap, size);
+    }
+    chunk->next = heap->chunk;
+    chunk->size = chunk_size;
+    heap->mapped += chunk_size;
+
+    if (heap->chunk) {
+        heap->retired += (size_t)(heap->cursor - ((char*)heap->chunk + CHUNK_HEADER));
+    }
+    heap->chunk = chunk;
+    heap->cursor = (char*)chunk + CHUNK_HEADER;
+    heap->end = (char*)chunk + chunk_size;
+
+    void* ptr = heap->cursor;
+    heap->cursor += size;
+    return ptr;
+}
 
 void* minall_malloc(size_t size) {
+    Heap* heap = &minall_current->heap;
     // Align to 8-byte boundary for better performance
     size = (size + 7) & ~7;
-    
-    if (memory_offset + size > MEMORY_POOL_SIZE) {
-        fprintf(stderr, "Memory pool exhausted!\n");
-        return NULL;
-    }
-    
-    void* ptr = &memory_pool[memory_offset];
-    memory_offset += size;
+
+    if (UNLIKELY((size_t)(heap->end - heap->cursor) < size)) {
+        return chunk_malloc(heap, size);
+    }
+
+    void* ptr = heap->cursor;
+    heap->cursor += size;
     return ptr;
 }
 
+// Extends the part of the value arena that counts against the limit,
+// reserving the address range on first use
+static void value_grow(Heap* heap, size_t size) {
+    if (!heap->value_pool) {
+        void* ptr = map_anywhere(heap, heap->limit, heap->limit, MAP_NORESERVE);
+        if (ptr == MAP_FAILED) {
+            fprintf(stderr, "Could not reserve %zu bytes for the value arena\n", heap->limit);
+            exit(1);
+        }
+        heap->value_pool = (char*)ptr;
+        advise_huge_pages(heap, heap->value_pool, heap->limit);
+    }
+
+    size_t end = (heap->value_offset + size + MEMORY_CHUNK_SIZE - 1) & ~(size_t)(MEMORY_CHUNK_SIZE - 1);
+    if (heap->mapped + end > heap->limit) {
+        memory_exhausted(heap, size);
+    }
+    heap->value_end = end;
+}
+
+void* minall_value_malloc(size_t size) {
+    Heap* heap = &minall_current->heap;
+    size = (size + 7) & ~7;
+
+    if (UNLIKELY(heap->value_offset + size > heap->value_end)) {
+        value_grow(heap, size);
+    }
+
+    void* ptr = &heap->value_pool[heap->value_offset];
+    heap->value_offset += size;
+    if (heap->value_offset > heap->value_peak) {
+        heap->value_peak = heap->value_offset;
+    }
+    return ptr;
+}
+
+// Protects every value allocated below end from the releases of the
+// regions that are open now; used when a value escapes to a global
+void minall_keep(const void* end) {
+    Heap* heap = &minall_current->heap;
+    size_t offset = (size_t)((const char*)end - heap->value_pool);
+    offset = (offset + 7) & ~(size_t)7;
+    if (offset > heap->value_kept) {
+        heap->value_kept = offset;
+    }
+}
+
+// Sets up an empty heap; nothing is mapped until the first allocation
+void minall_heap_init(Heap* heap, size_t limit, bool huge_pages) {
+    memset(heap, 0, sizeof(Heap));
+    heap->limit = limit;
+    heap->huge_pages = huge_pages;
+    if (__sync_bool_compare_and_swap(&heap_address_taken, 0, 1)) {
+        heap->address = HEAP_ADDRESS;
+        heap->fixed = true;
+    }
+}
+
+void minall_heap_free(Heap* heap) {
+    while (heap->chunk) {
+        MemoryChunk* next = heap->chunk->next;
+        munmap(heap->chunk, heap->chunk->size);
+        heap->chunk = next;
+    }
+    if (heap->value_pool) {
+        munmap(heap->value_pool, heap->limit);
+    }
+    if (heap->address) {
+        __sync_lock_release(&heap_address_taken);
+    }
+    memset(heap, 0, sizeof(Heap));
+}
+
+static size_t compile_memory_used(Heap* heap) {
+    if (!heap->chunk) return 0;
+    return heap->retired + (size_t)(heap->cursor - ((char*)heap->chunk + CHUNK_HEADER));
+}
+
+size_t minall_memory_used() {
+    Heap* heap = &minall_current->heap;
+    return compile_memory_used(heap) + heap->value_offset;
+}
+
+size_t minall_memory_peak() {
+    Heap* heap = &minall_current->heap;
+    size_t peak = compile_memory_used(heap) + heap->value_peak;
+    return peak > heap->peak ? peak : heap->peak;
+}
+
+void minall_memory_stats(MemoryStats* stats) {
+    Heap* heap = &minall_current->heap;
+    stats->compile_used = compile_memory_used(heap);
+    stats->compile_mapped = heap->mapped;
+    stats->chunk_count = 0;
+    for (MemoryChunk* chunk = heap->chunk; chunk; chunk = chunk->next) {
+        stats->chunk_count++;
+    }
+    stats->value_used = heap->value_offset;
+    stats->value_committed = heap->value_end;
+    stats->peak = minall_memory_peak();
+    stats->limit = heap->limit;
+}
+
+// Describes the heap for a snapshot; false if it has nothing in it or any
+// part of it is not at its fixed address
+bool minall_heap_state(HeapState* state) {
+    Heap* heap = &minall_current->heap;
+    if (!heap->fixed || !heap->chunk) {
+        return false;
+    }
+    state->limit = heap->limit;
+    state->compile_base = (char*)heap->address;
+    state->compile_mapped = heap->mapped;
+    state->compile_saved = (size_t)(heap->cursor - state->compile_base);
+    state->chunk = heap->chunk;
+    state->cursor = heap->cursor;
+    state->end = heap->end;
+    state->retired = heap->retired;
+    state->value_base = heap->value_pool;
+    state->value_offset = heap->value_offset;
+    state->value_end = heap->value_end;
+    state->value_kept = heap->value_kept;
+    state->value_peak = heap->value_peak;
+    return true;
+}
+
+// Maps a saved heap back: each arena's address range is reserved as before
+// and the saved bytes are mapped copy-on-write from fd over its start, so
+// restoring costs the same however large the heap is. Only possible in a
+// heap that holds the fixed address and has not allocated anything.
+bool minall_heap_restore(const HeapState* state, int fd, uint64_t compile_at, uint64_t value_at) {
+    Heap* heap = &minall_current->heap;
+    if (!heap->fixed || heap->chunk || heap->value_pool ||
+        (uintptr_t)state->compile_base != heap->address) {
+        return false;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t compile_saved = (state->compile_saved + page - 1) & ~(page - 1);
+    size_t value_saved = (state->value_offset + page - 1) & ~(page - 1);
+
+    if (map_at((uintptr_t)state->compile_base, state->compile_mapped, 0) == MAP_FAILED) {
+        return false;
+    }
+    if (map_at((uintptr_t)state->value_base, state->limit, MAP_NORESERVE) == MAP_FAILED) {
+        munmap(state->compile_base, state->compile_mapped);
+        return false;
+    }
+    if ((compile_saved &&
+         mmap(state->compile_base, compile_saved, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_FIXED, fd, (off_t)compile_at) == MAP_FAILED) ||
+        (value_saved &&
+         mmap(state->value_base, value_saved, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_FIXED, fd, (off_t)value_at) == MAP_FAILED)) {
+        munmap(state->compile_base, state->compile_mapped);
+        munmap(state->value_base, state->limit);
+        return false;
+    }
+
+    heap->limit = state->limit;
+    heap->chunk = (MemoryChunk*)state->chunk;
+    heap->cursor = state->cursor;
+    heap->end = state->end;
+    heap->retired = state->retired;
+    heap->mapped = state->compile_mapped;
+    heap->value_pool = state->value_base;
+    heap->value_offset = state->value_offset;
+    heap->value_end = state->value_end;
+    heap->value_kept = state->value_kept;
+    heap->value_peak = state->value_peak;
+    return true;
+}
+
+// Empties the current isolate's value arena but keeps the compile arena,
+// so a compiled program can run again without being compiled again
+void minall_reset_values() {
+    Heap* heap = &minall_current->heap;
+    heap->peak = minall_memory_peak();
+
+    // Give back all but the first chunk's worth of value pages
+    if (heap->value_end > MEMORY_CHUNK_SIZE) {
+        madvise(heap->value_pool + MEMORY_CHUNK_SIZE, heap->value_end - MEMORY_CHUNK_SIZE, MADV_DONTNEED);
+        heap->value_end = MEMORY_CHUNK_SIZE;
+    }
+    heap->value_offset = 0;
+    heap->value_kept = 0;
+    heap->value_peak = 0;
+
+    gc_reset();
+}
+
+// Empties the current isolate's heap for the next script
 void minall_reset() {
-    memory_offset = 0;
+    Heap* heap = &minall_current->heap;
+    heap->peak = minall_memory_peak();
+
+    // Keep the oldest chunk for the next script
+    while (heap->chunk && heap->chunk->next) {
+        MemoryChunk* next = heap->chunk->next;
+        heap->mapped -= heap->chunk->size;
+        munmap(heap->chunk, heap->chunk->size);
+        heap->chunk = next;
+    }
+    if (heap->chunk) {
+        heap->cursor = (char*)heap->chunk + CHUNK_HEADER;
+        heap->end = (char*)heap->chunk + heap->chunk->size;
+    }
+    heap->retired = 0;
+
+    minall_reset_values();
+    atom_table_reset();
 }
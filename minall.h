@@ -8,18 +8,63 @@
 #include <stdbool.h>
 #include <time.h>
 
-// Memory pool configuration - optimized for speed
-#define MEMORY_POOL_SIZE (2 * 1024 * 1024) // 2MB for better performance
-#define MAX_TOKENS 50000
+#define MINALL_VERSION "1.0"
+
+// Memory configuration, see memory.c
+#define MEMORY_CHUNK_SIZE (2 * 1024 * 1024)            // arena growth step, one huge page
+#define MEMORY_LIMIT_DEFAULT ((size_t)1024 * 1024 * 1024) // both arenas together
+#define GC_MIN_HEAP (1024 * 1024)                      // value bytes before the first major GC
 #define MAX_VARIABLES 1000
-#define MAX_FUNCTIONS 100
-#define MAX_CALL_STACK 100
+#define MAX_CALL_STACK 1000
+#define SLOT_STACK_SIZE (16 * 1024)                    // tree-walker frame slots
+#define VM_STACK_SIZE (16 * 1024)
+
+// Call targets assigned by resolve_program; user functions use their
+// function index (>= 0), natives CALL_NATIVE_BASE minus their native index
+#define CALL_UNRESOLVED -1
+#define CALL_BUILTIN_PRINT -2
+#define CALL_NATIVE_BASE -3
+
+// Type feedback recorded by the tree walker before quickening a node
+#define QUICKEN_THRESHOLD 8
+#define FEEDBACK_NUMBERS 1      // both operands numbers / callee a declared function
+#define FEEDBACK_STRINGS 2      // BINARY_ADD with a string operand
+#define FEEDBACK_OTHER 4
 
 // Performance optimizations
 #define INLINE __attribute__((always_inline)) inline
 #define LIKELY(x)   __builtin_expect(!!(x), 1)
 #define UNLIKELY(x) __builtin_expect(!!(x), 0)
 
+// Per-thread storage; C99 has no keyword for it, GCC and Clang have __thread.
+// The initial-exec model keeps accesses a single load in libminall.so too,
+// instead of a call into the dynamic linker
+#define MINALL_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+
+// VM dispatch: direct threading via computed goto where the compiler supports
+// labels-as-values, portable switch loop with -DMINALL_SWITCH_DISPATCH
+#if defined(__GNUC__) && !defined(MINALL_SWITCH_DISPATCH)
+#define MINALL_THREADED_DISPATCH
+#endif
+
+// Lexer scanning: runs of whitespace, identifier characters, string bodies
+// and comments are classified 32 (AVX2) or 16 (SSE2) bytes at a time where
+// the target has the instructions, a byte at a time with
+// -DMINALL_SCALAR_LEXER. The vector loads are aligned and may read past the
+// terminating NUL within its block, which AddressSanitizer would report, so
+// sanitized builds use the scalar loops too.
+#if !defined(MINALL_SCALAR_LEXER) && !defined(__SANITIZE_ADDRESS__) && defined(__AVX2__)
+#define MINALL_LEXER_AVX2
+#elif !defined(MINALL_SCALAR_LEXER) && !defined(__SANITIZE_ADDRESS__) && defined(__SSE2__)
+#define MINALL_LEXER_SSE2
+#endif
+
+// Value layout: NaN-boxed 64-bit words on 64-bit targets, tagged structs with
+// -DMINALL_TAGGED_VALUES or where pointers do not fit in a NaN payload
+#if !defined(MINALL_TAGGED_VALUES) && UINTPTR_MAX == UINT64_MAX
+#define MINALL_NAN_BOXING
+#endif
+
 // Token types
 typedef enum {
     TOKEN_NUMBER,
@@ -58,14 +103,45 @@ typedef enum {
     TOKEN_UNKNOWN
 } TokenType;
 
+// Interned identifier or string literal; see atom.c
+typedef struct Atom {
+    const char* chars;      // length bytes, often a span of the source
+    uint32_t length;
+    uint32_t hash;
+} Atom;
+
+// Length-prefixed string value; a rope until its characters are first
+// needed, see string.c
+typedef struct String {
+    uint32_t length;
+    bool is_rope;
+    bool forwarded;             // moved by the collector, see gc.c
+    union {
+        const char* chars;      // length bytes, not always NUL-terminated;
+                                // use string_chars()
+        struct {
+            struct String* left;
+            struct String* right;
+        } rope;
+        struct String* forward;
+    } data;
+} String;
+
 typedef struct {
     TokenType type;
-    char* value;
+    Atom* value;
     double number;
     int line;
     int column;
 } Token;
 
+// Cursor over the source; lexer_next() scans one token at a time
+typedef struct {
+    const char* current;
+    int line;
+    int column;
+} Lexer;
+
 // AST Node types
 typedef enum {
     NODE_PROGRAM,
@@ -82,25 +158,89 @@ typedef enum {
     NODE_BLOCK,
     NODE_IDENTIFIER,
     NODE_NUMBER,
-    NODE_STRING
+    NODE_STRING,
+    // Specialized binary ops from optimize_program; they keep the binary_op
+    // layout, so an engine may treat them as NODE_BINARY_OP
+    NODE_BINARY_NUMERIC,    // both operands always evaluate to numbers
+    NODE_BINARY_VAR_CONST,  // variable op number literal
+    NODE_BINARY_VAR_VAR,    // variable op variable
+    // Quickened nodes, rewritten by the tree walker from the types a node
+    // has seen. Only the compiler sees them afterwards, and compiles them
+    // as the generic node; a failed guard turns them back into it
+    NODE_NUMBERS_ADD,       // NODE_BINARY_OP that has only seen numbers, one
+    NODE_NUMBERS_SUB,       // kind per BinaryOperator in the same order
+    NODE_NUMBERS_MUL,
+    NODE_NUMBERS_DIV,
+    NODE_NUMBERS_MOD,
+    NODE_NUMBERS_LT,
+    NODE_NUMBERS_LE,
+    NODE_NUMBERS_GT,
+    NODE_NUMBERS_GE,
+    NODE_NUMBERS_EQ,
+    NODE_NUMBERS_NE,
+    NODE_NUMBERS_AND,
+    NODE_NUMBERS_OR,
+    NODE_BINARY_CONCAT,     // BINARY_ADD that has only seen a string operand
+    NODE_CALL_FUNCTION      // NODE_CALL that has only reached a declared function
 } NodeType;
 
+// Operators, decoded once by the parser
+typedef enum {
+    BINARY_ADD,
+    BINARY_SUB,
+    BINARY_MUL,
+    BINARY_DIV,
+    BINARY_MOD,
+    BINARY_LT,
+    BINARY_LE,
+    BINARY_GT,
+    BINARY_GE,
+    BINARY_EQ,
+    BINARY_NE,
+    BINARY_AND,
+    BINARY_OR
+} BinaryOperator;
+
+typedef enum {
+    UNARY_NEG,
+    UNARY_NOT
+} UnaryOperator;
+
+// Bumped whenever an opcode's operands or behaviour change in a way the
+// opcode names do not show, so cached bytecode from older builds is rejected
+#define BYTECODE_VERSION 1
+
 // Fast execution opcodes for hot loops
 typedef enum {
     OP_LOAD_NUMBER,
+    OP_LOAD_STRING,
+    OP_LOAD_UNDEFINED,
     OP_LOAD_VAR,
     OP_STORE_VAR,
+    OP_LOAD_GLOBAL,
+    OP_STORE_GLOBAL,
+    OP_DUP,
+    OP_POP,
     OP_ADD,
     OP_SUB,
     OP_MUL,
     OP_DIV,
     OP_MOD,
+    OP_NEG,
+    OP_NOT,
+    OP_AND,
+    OP_OR,
     OP_CMP_LT,
+    OP_CMP_LE,
     OP_CMP_GT,
+    OP_CMP_GE,
     OP_CMP_EQ,
+    OP_CMP_NE,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
     OP_CALL,
+    OP_CALL_NATIVE,
+    OP_PRINT,
     OP_RETURN,
     OP_HALT
 } OpCode;
@@ -109,40 +249,63 @@ typedef struct {
     OpCode op;
     union {
         double number;
+        int string_index;   // into BytecodeProgram.strings
         int var_index;
-        int jump_offset;
+        int jump_offset;    // relative to the next instruction
+        struct {
+            int function_index;
+            int arg_count;
+        } call;
     } operand;
 } Instruction;
 
+struct FastLoop;
+
 typedef struct ASTNode {
     NodeType type;
     union {
         double number;
-        char* string;
-        char* identifier;
         struct {
-            char* name;
+            Atom* atom;
+            String* value;      // immutable; every evaluation returns it as is
+        } string;
+        struct {
+            Atom* name;
+            int slot;           // frame or global slot, set by resolve_program
+            bool is_global;
+        } identifier;
+        struct {
+            Atom* name;
             struct ASTNode* value;
+            int slot;
+            bool is_global;
         } var_decl;
         struct {
-            char* name;
-            char** params;
+            Atom* name;
+            Atom** params;      // occupy frame slots 0..param_count-1
             int param_count;
             struct ASTNode* body;
+            int local_count;    // params + locals, set by resolve_program
+            int function_index; // shared by all declarations of this name
         } func_decl;
         struct {
-            char* operator;
+            BinaryOperator operator;    // unused by NODE_ASSIGNMENT
+            uint8_t feedback;           // FEEDBACK_* bits seen by the tree walker
+            uint8_t hits;
             struct ASTNode* left;
             struct ASTNode* right;
         } binary_op;
         struct {
-            char* operator;
+            UnaryOperator operator;
             struct ASTNode* operand;
         } unary_op;
         struct {
             struct ASTNode* function;
             struct ASTNode** args;
             int arg_count;
+            int target;         // function index or CALL_* marker
+            uint8_t feedback;
+            uint8_t hits;
         } call;
         struct {
             struct ASTNode* condition;
@@ -150,10 +313,12 @@ typedef struct ASTNode {
             struct ASTNode* else_branch;
         } if_stmt;
         struct {
-            struct ASTNode* init;
+            struct ASTNode* init;       // any part may be NULL
             struct ASTNode* condition;
             struct ASTNode* update;
             struct ASTNode* body;
+            struct FastLoop* fast_loop; // compiled on first run, see fastloop.c
+            bool fast_checked;
         } for_stmt;
         struct {
             struct ASTNode* condition;
@@ -164,7 +329,13 @@ typedef struct ASTNode {
         } return_stmt;
         struct {
             struct ASTNode** statements;
+            Atom** global_names;    // NODE_PROGRAM only, set by resolve_program
+            Atom** function_names;  // NODE_PROGRAM only, by function index
             int count;
+            int global_count;
+            int function_count;
+            int inherited_globals;  // NODE_PROGRAM only, globals and functions
+            int inherited_functions; // of the prelude it continues
         } block;
     } data;
 } ASTNode;
@@ -177,78 +348,458 @@ typedef enum {
     VALUE_UNDEFINED
 } ValueType;
 
+// Only the value_* helpers below look inside a Value, so the layout can be
+// switched at build time without touching the engines.
+#ifdef MINALL_NAN_BOXING
+
+// Numbers are stored as plain doubles. Everything else is a quiet NaN with
+// bit 50 set, which arithmetic never produces (the default NaN is
+// 0x7ff8.../0xfff8...). Strings set the sign bit and keep the pointer in
+// the low 48 bits; other types use the tag in bits 48-49.
+typedef struct {
+    uint64_t bits;
+} Value;
+
+#define NANBOX_QNAN       0x7ffc000000000000ull
+#define NANBOX_SIGN       0x8000000000000000ull
+#define NANBOX_PAYLOAD    0x0000ffffffffffffull
+#define NANBOX_UNDEFINED  (NANBOX_QNAN | 0x0001000000000000ull)
+#define NANBOX_STRING     (NANBOX_QNAN | NANBOX_SIGN)
+
+static INLINE Value value_number(double number) {
+    Value value;
+    memcpy(&value.bits, &number, sizeof(double));
+    return value;
+}
+
+static INLINE Value value_string(String* string) {
+    Value value;
+    value.bits = NANBOX_STRING | ((uint64_t)(uintptr_t)string & NANBOX_PAYLOAD);
+    return value;
+}
+
+static INLINE Value value_undefined(void) {
+    Value value;
+    value.bits = NANBOX_UNDEFINED;
+    return value;
+}
+
+static INLINE bool value_is_number(Value value) {
+    return (value.bits & NANBOX_QNAN) != NANBOX_QNAN;
+}
+
+static INLINE bool value_is_string(Value value) {
+    return (value.bits & NANBOX_STRING) == NANBOX_STRING;
+}
+
+static INLINE double value_as_number(Value value) {
+    double number;
+    memcpy(&number, &value.bits, sizeof(double));
+    return number;
+}
+
+static INLINE String* value_as_string(Value value) {
+    return (String*)(uintptr_t)(value.bits & NANBOX_PAYLOAD);
+}
+
+static INLINE ValueType value_type(Value value) {
+    if (value_is_number(value)) return VALUE_NUMBER;
+    if (value_is_string(value)) return VALUE_STRING;
+    return VALUE_UNDEFINED;
+}
+
+#else
+
 typedef struct {
     ValueType type;
     union {
         double number;
-        char* string;
-        struct {
-            char** params;
-            int param_count;
-            ASTNode* body;
-        } function;
+        String* string;
     } data;
 } Value;
 
+static INLINE Value value_number(double number) {
+    Value value;
+    value.type = VALUE_NUMBER;
+    value.data.number = number;
+    return value;
+}
+
+static INLINE Value value_string(String* string) {
+    Value value;
+    value.type = VALUE_STRING;
+    value.data.string = string;
+    return value;
+}
+
+static INLINE Value value_undefined(void) {
+    Value value;
+    value.type = VALUE_UNDEFINED;
+    return value;
+}
+
+static INLINE bool value_is_number(Value value) {
+    return value.type == VALUE_NUMBER;
+}
+
+static INLINE bool value_is_string(Value value) {
+    return value.type == VALUE_STRING;
+}
+
+static INLINE double value_as_number(Value value) {
+    return value.data.number;
+}
+
+static INLINE String* value_as_string(Value value) {
+    return value.data.string;
+}
+
+static INLINE ValueType value_type(Value value) {
+    return value.type;
+}
+
+#endif
+
 // Variable storage
 typedef struct {
-    char* name;
+    Atom* name;
     Value value;
 } Variable;
 
 // Function storage
 typedef struct {
-    char* name;
-    char** params;
+    Atom* name;
+    Atom** params;
     int param_count;
+    int local_count;
     ASTNode* body;
 } Function;
 
-// Execution context
+// Activation record of a tree-walker call. Slots hold the function's
+// params followed by its locals and live on a shared slot stack.
 typedef struct {
+    Function* function;
+    Value* slots;
+} Frame;
+
+// Execution context - one per running program. `variables` is the global
+// table; calls push a Frame instead of copying the context.
+typedef struct Context {
     Variable variables[MAX_VARIABLES];
     int var_count;
-    Function functions[MAX_FUNCTIONS];
+    Function* functions;        // indexed like func_decl.function_index
     int func_count;
+    int func_capacity;
+    Frame frames[MAX_CALL_STACK];
+    int frame_count;
+    Value* slots;               // slots of the innermost frame
+    Value* slot_top;            // first free slot above all frames
     Value return_value;
     bool has_return;
+    bool stored_string;         // a run-time string went into a local since
+                                // the innermost region opened
 } Context;
 
+// Storage of a resolved variable
+static INLINE Value* variable_slot(Context* ctx, int slot, bool is_global) {
+    return is_global ? &ctx->variables[slot].value : &ctx->slots[slot];
+}
+
+// Compiled bytecode for the stack VM
+typedef struct {
+    Atom* name;
+    Instruction* code;
+    int code_count;
+    int code_capacity;
+    int param_count;
+    int local_count;    // params + locals, in frame slot order
+    int max_stack;      // deepest operand stack use in this function
+} BytecodeFunction;
+
+typedef struct {
+    BytecodeFunction* functions;    // index 0 is the top-level script
+    int function_count;
+    int function_capacity;
+    String* strings;                // string constants
+    int string_count;
+    int string_capacity;
+    Atom** global_names;
+    int global_count;
+    const void* image;              // cache file the code is mapped from,
+    size_t image_size;              // if any; see cache.c
+    Value* globals;                 // allocated by the first run, reused
+} BytecodeProgram;
+
+// Activation record of a VM call
+typedef struct {
+    BytecodeFunction* function;
+    Instruction* return_ip;
+    Value* slots;
+} CallFrame;
+
 // Memory management
-extern char memory_pool[MEMORY_POOL_SIZE];
-extern size_t memory_offset;
+typedef struct {
+    size_t compile_used;
+    size_t compile_mapped;
+    int chunk_count;
+    size_t value_used;
+    size_t value_committed;
+    size_t peak;                // compile plus value bytes, over all scripts
+    size_t limit;
+} MemoryStats;
+
+// Arena bookkeeping saved in a heap snapshot, see memory.c and snapshot.c
+typedef struct {
+    size_t limit;
+    char* compile_base;         // chunks lie end to end from here
+    size_t compile_mapped;
+    size_t compile_saved;       // bytes up to the allocation cursor
+    void* chunk;
+    char* cursor;
+    char* end;
+    size_t retired;
+    char* value_base;
+    size_t value_offset;
+    size_t value_end;
+    size_t value_kept;
+    size_t value_peak;
+} HeapState;
+
+// The compile and value arenas of an isolate, see memory.c
+typedef struct {
+    struct MemoryChunk* chunk;  // current chunk, newest first
+    char* cursor;
+    char* end;
+    size_t retired;             // bytes used in older chunks
+    size_t mapped;              // bytes mapped for chunks
+    size_t peak;
+    size_t limit;
+    uintptr_t address;          // where the arenas go, 0 for anywhere
+    bool huge_pages;
+    bool fixed;                 // every mapping at its planned address
+    char* value_pool;
+    size_t value_offset;
+    size_t value_end;
+    size_t value_peak;
+    size_t value_kept;          // values below this offset may be reachable
+                                // from outside every open region
+} Heap;
+
+// Garbage collection of the value arena, see gc.c
+typedef struct {
+    int minor_count;
+    int major_count;
+    double minor_seconds;
+    double major_seconds;
+    double max_pause;
+    size_t reclaimed;           // bytes
+} GcStats;
+
+typedef struct {
+    size_t threshold;           // value bytes that trigger a major collection
+    GcStats stats;
+    size_t base;                // start of the collected range
+    size_t top;                 // where the copies start
+    bool major;
+    double started;
+} GcState;
+
+// Open-addressed table of atom pointers, kept at most half full; it lives
+// in the compile arena, so a heap snapshot only needs this, see atom.c
+typedef struct {
+    Atom** slots;
+    uint32_t capacity;
+    uint32_t count;
+    Atom* print;                // names the runtime itself checks for
+} AtomTable;
+
+// Function provided by the embedder, see isolate.c and api.c. Values it
+// creates go in the value arena like any other.
+typedef Value (*NativeFunction)(Value* args, int arg_count, void* data);
+
+typedef struct {
+    Atom* name;                 // re-interned whenever the atom table resets
+    char* chars;
+    uint32_t length;
+    NativeFunction function;
+    void* data;
+} Native;
+
+// One independent runtime: its arenas, atoms, collector, global context and
+// engine stacks. Every thread runs in the isolate it last entered, and an
+// isolate must only be entered on one thread at a time; isolates share
+// nothing, so any number of them can run in parallel. See isolate.c.
+typedef struct MinallIsolate {
+    Heap heap;
+    AtomTable atoms;
+    GcState gc;
+    FILE* out;                  // where print writes
+    Context context;
+    Value slot_stack[SLOT_STACK_SIZE];
+    Value vm_stack[VM_STACK_SIZE];
+    CallFrame vm_frames[MAX_CALL_STACK];
+    Native* natives;            // called by name like print, see link_call
+    int native_count;
+    int native_capacity;
+} MinallIsolate;
+
+extern MINALL_THREAD_LOCAL MinallIsolate* minall_current;
+
+MinallIsolate* minall_isolate_new(size_t memory_limit, bool huge_pages);
+void minall_isolate_enter(MinallIsolate* isolate);
+void minall_isolate_free(MinallIsolate* isolate);
+bool minall_run_jobs(int count, int jobs, void (*task)(int index, void* data), void* data);
+int minall_define_native(const char* name, NativeFunction function, void* data);
+int minall_find_native(Atom* name);
+
+// True if ptr was allocated by minall_value_malloc
+static INLINE bool minall_is_value(const void* ptr) {
+    Heap* heap = &minall_current->heap;
+    return (const char*)ptr >= heap->value_pool && (const char*)ptr < heap->value_pool + heap->value_end;
+}
+
+// Value regions: minall_release(minall_mark()) frees every value allocated
+// in between, except what minall_keep() protected in the meantime
+static INLINE size_t minall_mark(void) {
+    return minall_current->heap.value_offset;
+}
+
+static INLINE void minall_release(size_t mark) {
+    Heap* heap = &minall_current->heap;
+    heap->value_offset = mark > heap->value_kept ? mark : heap->value_kept;
+}
+
+// True once the value arena has grown enough for a major collection
+static INLINE bool gc_due(void) {
+    return minall_current->heap.value_offset >= minall_current->gc.threshold;
+}
+
+void gc_begin(size_t from, bool major);
+bool gc_trace(Value* root);
+void gc_end();
+void gc_stats(GcStats* stats);
+void gc_reset();
+
+// Atom table functions
+Atom* atom_intern(const char* chars, uint32_t length);
+Atom* atom_intern_span(const char* chars, uint32_t length);
+Atom* atom_find(const char* chars, uint32_t length);
+void atom_table_reset();
+void atom_table_state(AtomTable* state);
+void atom_table_restore(const AtomTable* state);
+
+// Strings
+String* string_from_chars(const char* chars, uint32_t length);
+String* string_from_atom(Atom* atom);
+String* string_from_number(double number);
+String* string_concat(String* left, String* right);
+const char* string_chars(String* string);
+void string_print(String* string, FILE* out);
 
 // Lexer functions
+void lexer_init(Lexer* lexer, const char* source);
+void lexer_next(Lexer* lexer, Token* token);
+// The keyword an identifier span spells, or TOKEN_IDENTIFIER
+TokenType lexer_keyword_type(const char* start, int length);
 Token* tokenize(const char* source, int* token_count);
 void print_tokens(Token* tokens, int count);
 
-// Parser functions
-ASTNode* parse(Token* tokens, int token_count);
+// Parser functions; parse() reports a syntax error and returns NULL
+ASTNode* parse(const char* source);
 void print_ast(ASTNode* node, int depth);
 
+// Scope resolution - assigns frame and global slots to every variable;
+// false, with the error reported, if a scope has too many
+bool resolve_program(ASTNode* program);
+bool resolve_program_after(ASTNode* program, ASTNode* prelude);
+
+// AST rewrites on a resolved program
+void optimize_program(ASTNode* program);
+
 // Interpreter functions
 Value interpret(ASTNode* node, Context* ctx);
 void init_context(Context* ctx);
 void set_variable(Context* ctx, const char* name, Value value);
 Value get_variable(Context* ctx, const char* name);
 
+// Bytecode compiler and VM functions
+BytecodeProgram* compile_program(ASTNode* program);
+void print_bytecode(BytecodeProgram* program);
+int opcode_stack_effect(OpCode op);
+const char* opcode_name(OpCode op);
+Value vm_execute(BytecodeProgram* program, Value* script_args, int script_arg_count);
+// vm_execute built with the switch loop, for the benchmark's comparison;
+// only in the minall binary
+Value vm_execute_switch(BytecodeProgram* program, Value* script_args, int script_arg_count);
+
+// Compiled script cache, see cache.c
+uint64_t cache_hash(const char* chars, size_t length);
+char* cache_path(const char* script, uint64_t hash, bool optimized);
+bool cache_write(const char* path, BytecodeProgram* program, uint64_t hash,
+                 size_t source_length, bool optimized);
+BytecodeProgram* cache_load(const char* path, uint64_t hash, size_t source_length,
+                            bool optimized);
+void cache_release(BytecodeProgram* program);
+
 // Memory management functions
 void* minall_malloc(size_t size);
+void* minall_value_malloc(size_t size);
+void minall_keep(const void* end);
+void minall_out_of_memory(size_t size);
+size_t minall_memory_used();
+size_t minall_memory_peak();
+void minall_memory_stats(MemoryStats* stats);
+void minall_heap_init(Heap* heap, size_t limit, bool huge_pages);
+void minall_heap_free(Heap* heap);
+bool minall_heap_state(HeapState* state);
+bool minall_heap_restore(const HeapState* state, int fd, uint64_t compile_at, uint64_t value_at);
+void minall_reset_values();
 void minall_reset();
 
-// Benchmarking functions
-double benchmark_execution(const char* source, int iterations);
-void run_performance_tests();
+// Heap snapshots of a prelude's run, see snapshot.c
+bool snapshot_write(const char* path, ASTNode* prelude, Context* ctx);
+bool snapshot_load(const char* path, ASTNode** prelude, Context* ctx);
+
+// Benchmarking functions; benchmark_execution is negative for a program
+// that does not compile
+double benchmark_execution(const char* source, int iterations, bool optimize);
+void run_performance_tests(bool optimize, int jobs);
 
 // Fast loop execution functions
-void init_fast_vm();
 bool is_simple_for_loop(ASTNode* node);
-double execute_fast_loop(ASTNode* for_node, Context* ctx);
+bool execute_fast_loop(ASTNode* for_node, Context* ctx);
 
 // Utility functions
 Value create_number(double num);
-Value create_string(const char* str);
 Value create_undefined();
+Value concat_values(Value left, Value right);
 void print_value(Value value);
 
+// Result of a binary operator on two numbers, shared by the tree walker and
+// constant folding so both agree
+static INLINE double numeric_binary_op(BinaryOperator operator, double l, double r) {
+    switch (operator) {
+        case BINARY_ADD: return l + r;
+        case BINARY_SUB: return l - r;
+        case BINARY_MUL: return l * r;
+        case BINARY_DIV: return LIKELY(r != 0) ? l / r : 0;
+        case BINARY_MOD: return LIKELY(r != 0) ? (double)((int)l % (int)r) : 0;
+        case BINARY_LT:  return l < r ? 1 : 0;
+        case BINARY_LE:  return l <= r ? 1 : 0;
+        case BINARY_GT:  return l > r ? 1 : 0;
+        case BINARY_GE:  return l >= r ? 1 : 0;
+        case BINARY_EQ:  return l == r ? 1 : 0;
+        case BINARY_NE:  return l != r ? 1 : 0;
+        case BINARY_AND: return l != 0 && r != 0 ? 1 : 0;
+        case BINARY_OR:  return l != 0 || r != 0 ? 1 : 0;
+    }
+    return 0;
+}
+
+static INLINE bool is_truthy(Value value) {
+    if (value_is_number(value)) return value_as_number(value) != 0;
+    if (value_is_string(value)) return value_as_string(value)->length != 0;
+    return false;
+}
+
 #endif
@@ -0,0 +1,385 @@
+#include "minall.h"
+
+// AST optimizer - rewrites a resolved program in place before it runs.
+//
+// Each function body (and the top-level script) is walked in statement
+// order:
+//   - reads of a `var` that is written exactly once, by a top-level
+//     declaration with a literal initializer, are replaced by the literal
+//     in statements after that declaration. Earlier reads and reads from
+//     other functions may run before the declaration, so they are left
+//     alone;
+//   - constant subexpressions are folded with the runtime's own semantics;
+//   - `if` and `while` with a constant condition lose their dead branch,
+//     unless it declares functions, which the VM hoists regardless;
+//   - remaining binary operations whose operand shapes are known become
+//     specialized node kinds, so the tree walker can skip evaluating leaf
+//     children and re-checking types. Rewritten nodes keep the binary_op
+//     layout, so the compiler lowers them like NODE_BINARY_OP.
+
+typedef struct {
+    int* writes;            // declarations + assignments per slot
+    ASTNode** constants;    // literal value per slot, once known
+    int count;
+} SlotTable;
+
+typedef struct {
+    SlotTable* globals;
+    SlotTable* locals;      // NULL at the top level
+    bool top_level;         // globals may only be propagated here
+} Optimizer;
+
+static void optimize_node(Optimizer* optimizer, ASTNode* node);
+
+static void init_slot_table(SlotTable* table, int count) {
+    table->count = count;
+    table->writes = (int*)minall_malloc((count + 1) * sizeof(int));
+    table->constants = (ASTNode**)minall_malloc((count + 1) * sizeof(ASTNode*));
+    memset(table->writes, 0, (count + 1) * sizeof(int));
+    memset(table->constants, 0, (count + 1) * sizeof(ASTNode*));
+}
+
+static void count_write(SlotTable* globals, SlotTable* locals, int slot, bool is_global) {
+    SlotTable* table = is_global ? globals : locals;
+    if (table && slot >= 0 && slot < table->count) {
+        table->writes[slot]++;
+    }
+}
+
+// Count writes to every slot. Locals are only counted in the function that
+// owns them; pass locals as NULL to count globals across the whole tree, or
+// globals as NULL to count one function's locals.
+static void count_writes(SlotTable* globals, SlotTable* locals, ASTNode* node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case NODE_VAR_DECLARATION:
+            count_write(globals, locals, node->data.var_decl.slot, node->data.var_decl.is_global);
+            count_writes(globals, locals, node->data.var_decl.value);
+            break;
+        case NODE_ASSIGNMENT: {
+            ASTNode* target = node->data.binary_op.left;
+            if (target->type == NODE_IDENTIFIER) {
+                count_write(globals, locals, target->data.identifier.slot, target->data.identifier.is_global);
+            }
+            count_writes(globals, locals, node->data.binary_op.right);
+            break;
+        }
+        case NODE_FUNCTION_DECLARATION:
+            if (!locals) {
+                count_writes(globals, NULL, node->data.func_decl.body);
+            }
+            break;
+        case NODE_BINARY_OP:
+            count_writes(globals, locals, node->data.binary_op.left);
+            count_writes(globals, locals, node->data.binary_op.right);
+            break;
+        case NODE_UNARY_OP:
+            count_writes(globals, locals, node->data.unary_op.operand);
+            break;
+        case NODE_CALL:
+            for (int i = 0; i < node->data.call.arg_count; i++) {
+                count_writes(globals, locals, node->data.call.args[i]);
+            }
+            break;
+        case NODE_IF:
+            count_writes(globals, locals, node->data.if_stmt.condition);
+            count_writes(globals, locals, node->data.if_stmt.then_branch);
+            count_writes(globals, locals, node->data.if_stmt.else_branch);
+            break;
+        case NODE_WHILE:
+            count_writes(globals, locals, node->data.while_stmt.condition);
+            count_writes(globals, locals, node->data.while_stmt.body);
+            break;
+        case NODE_FOR:
+            count_writes(globals, locals, node->data.for_stmt.init);
+            count_writes(globals, locals, node->data.for_stmt.condition);
+            count_writes(globals, locals, node->data.for_stmt.update);
+            count_writes(globals, locals, node->data.for_stmt.body);
+            break;
+        case NODE_RETURN:
+            count_writes(globals, locals, node->data.return_stmt.value);
+            break;
+        case NODE_BLOCK:
+        case NODE_PROGRAM:
+            for (int i = 0; i < node->data.block.count; i++) {
+                count_writes(globals, locals, node->data.block.statements[i]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static bool declares_function(ASTNode* node) {
+    if (!node) return false;
+
+    switch (node->type) {
+        case NODE_FUNCTION_DECLARATION:
+            return true;
+        case NODE_IF:
+            return declares_function(node->data.if_stmt.then_branch) ||
+                   declares_function(node->data.if_stmt.else_branch);
+        case NODE_WHILE:
+            return declares_function(node->data.while_stmt.body);
+        case NODE_FOR:
+            return declares_function(node->data.for_stmt.body);
+        case NODE_BLOCK:
+            for (int i = 0; i < node->data.block.count; i++) {
+                if (declares_function(node->data.block.statements[i])) return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+static bool is_literal(ASTNode* node) {
+    return node && (node->type == NODE_NUMBER || node->type == NODE_STRING);
+}
+
+static Value literal_value(ASTNode* node) {
+    return node->type == NODE_NUMBER ? value_number(node->data.number)
+                                     : value_string(node->data.string.value);
+}
+
+// Turn node into a literal holding value; false if value has no literal form
+static bool make_literal(ASTNode* node, Value value) {
+    if (value_is_number(value)) {
+        node->type = NODE_NUMBER;
+        node->data.number = value_as_number(value);
+        return true;
+    }
+    if (value_is_string(value)) {
+        String* string = value_as_string(value);
+        node->type = NODE_STRING;
+        node->data.string.atom = atom_intern(string_chars(string), string->length);
+        node->data.string.value = string_from_atom(node->data.string.atom);
+        return true;
+    }
+    return false;
+}
+
+static void fold_binary_op(ASTNode* node) {
+    ASTNode* left = node->data.binary_op.left;
+    ASTNode* right = node->data.binary_op.right;
+    if (!is_literal(left) || !is_literal(right)) return;
+
+    BinaryOperator operator = node->data.binary_op.operator;
+    if (left->type == NODE_NUMBER && right->type == NODE_NUMBER) {
+        make_literal(node, value_number(numeric_binary_op(operator, left->data.number, right->data.number)));
+    } else if (operator == BINARY_ADD) {
+        // Same formatting as a run-time concatenation
+        make_literal(node, concat_values(literal_value(left), literal_value(right)));
+    }
+}
+
+static void fold_unary_op(ASTNode* node) {
+    ASTNode* operand = node->data.unary_op.operand;
+    if (!is_literal(operand)) return;
+
+    if (node->data.unary_op.operator == UNARY_NOT) {
+        make_literal(node, value_number(is_truthy(literal_value(operand)) ? 0 : 1));
+    } else if (operand->type == NODE_NUMBER) {
+        make_literal(node, value_number(-operand->data.number));
+    }
+}
+
+// True when the expression always evaluates to a number
+static bool is_numeric(ASTNode* node) {
+    switch (node->type) {
+        case NODE_NUMBER:
+        case NODE_BINARY_NUMERIC:
+            return true;
+        case NODE_UNARY_OP:
+            // `!` always yields 0 or 1, `-` only preserves numbers
+            return node->data.unary_op.operator == UNARY_NOT ||
+                   is_numeric(node->data.unary_op.operand);
+        default:
+            return false;
+    }
+}
+
+static void specialize_binary_op(ASTNode* node) {
+    ASTNode* left = node->data.binary_op.left;
+    ASTNode* right = node->data.binary_op.right;
+
+    if (is_numeric(left) && is_numeric(right)) {
+        node->type = NODE_BINARY_NUMERIC;
+    } else if (left->type == NODE_IDENTIFIER && right->type == NODE_NUMBER) {
+        node->type = NODE_BINARY_VAR_CONST;
+    } else if (left->type == NODE_IDENTIFIER && right->type == NODE_IDENTIFIER) {
+        node->type = NODE_BINARY_VAR_VAR;
+    }
+}
+
+static void make_empty_block(ASTNode* node) {
+    node->type = NODE_BLOCK;
+    node->data.block.statements = NULL;
+    node->data.block.count = 0;
+}
+
+static void propagate_constant(Optimizer* optimizer, ASTNode* node) {
+    SlotTable* table = node->data.identifier.is_global
+        ? (optimizer->top_level ? optimizer->globals : NULL)
+        : optimizer->locals;
+    int slot = node->data.identifier.slot;
+
+    if (table && slot >= 0 && slot < table->count && table->constants[slot]) {
+        *node = *table->constants[slot];
+    }
+}
+
+// After a top-level declaration runs, later statements may use its value
+static void record_constant(Optimizer* optimizer, ASTNode* decl) {
+    ASTNode* value = decl->data.var_decl.value;
+    SlotTable* table = decl->data.var_decl.is_global
+        ? (optimizer->top_level ? optimizer->globals : NULL)
+        : optimizer->locals;
+    int slot = decl->data.var_decl.slot;
+
+    if (table && slot >= 0 && slot < table->count &&
+        table->writes[slot] == 1 && is_literal(value)) {
+        table->constants[slot] = value;
+    }
+}
+
+static void optimize_body(Optimizer* optimizer, ASTNode* block) {
+    for (int i = 0; i < block->data.block.count; i++) {
+        ASTNode* stmt = block->data.block.statements[i];
+        optimize_node(optimizer, stmt);
+        if (stmt && stmt->type == NODE_VAR_DECLARATION) {
+            record_constant(optimizer, stmt);
+        }
+    }
+}
+
+static void optimize_function(Optimizer* optimizer, ASTNode* node) {
+    ASTNode* body = node->data.func_decl.body;
+    if (!body) return;
+
+    SlotTable locals;
+    init_slot_table(&locals, node->data.func_decl.local_count);
+    count_writes(NULL, &locals, body);
+
+    // Parameters are written by every call
+    for (int i = 0; i < node->data.func_decl.param_count && i < locals.count; i++) {
+        locals.writes[i]++;
+    }
+
+    Optimizer inner = { optimizer->globals, &locals, false };
+    if (body->type == NODE_BLOCK) {
+        optimize_body(&inner, body);
+    } else {
+        optimize_node(&inner, body);
+    }
+}
+
+static void optimize_node(Optimizer* optimizer, ASTNode* node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            propagate_constant(optimizer, node);
+            break;
+
+        case NODE_BINARY_OP:
+            optimize_node(optimizer, node->data.binary_op.left);
+            optimize_node(optimizer, node->data.binary_op.right);
+            if (!node->data.binary_op.left || !node->data.binary_op.right) break;
+            fold_binary_op(node);
+            if (node->type == NODE_BINARY_OP) {
+                specialize_binary_op(node);
+            }
+            break;
+
+        case NODE_ASSIGNMENT:
+            optimize_node(optimizer, node->data.binary_op.right);
+            break;
+
+        case NODE_UNARY_OP:
+            optimize_node(optimizer, node->data.unary_op.operand);
+            fold_unary_op(node);
+            break;
+
+        case NODE_VAR_DECLARATION:
+            optimize_node(optimizer, node->data.var_decl.value);
+            break;
+
+        case NODE_FUNCTION_DECLARATION:
+            optimize_function(optimizer, node);
+            break;
+
+        case NODE_CALL:
+            for (int i = 0; i < node->data.call.arg_count; i++) {
+                optimize_node(optimizer, node->data.call.args[i]);
+            }
+            break;
+
+        case NODE_IF: {
+            optimize_node(optimizer, node->data.if_stmt.condition);
+            optimize_node(optimizer, node->data.if_stmt.then_branch);
+            optimize_node(optimizer, node->data.if_stmt.else_branch);
+
+            ASTNode* condition = node->data.if_stmt.condition;
+            if (!is_literal(condition)) break;
+
+            bool taken = is_truthy(literal_value(condition));
+            ASTNode* live = taken ? node->data.if_stmt.then_branch : node->data.if_stmt.else_branch;
+            ASTNode* dead = taken ? node->data.if_stmt.else_branch : node->data.if_stmt.then_branch;
+            if (declares_function(dead)) break;
+
+            if (live) {
+                *node = *live;
+            } else {
+                make_empty_block(node);
+            }
+            break;
+        }
+
+        case NODE_WHILE:
+            optimize_node(optimizer, node->data.while_stmt.condition);
+            optimize_node(optimizer, node->data.while_stmt.body);
+
+            if (is_literal(node->data.while_stmt.condition) &&
+                !is_truthy(literal_value(node->data.while_stmt.condition)) &&
+                !declares_function(node->data.while_stmt.body)) {
+                make_empty_block(node);
+            }
+            break;
+
+        case NODE_FOR:
+            optimize_node(optimizer, node->data.for_stmt.init);
+            optimize_node(optimizer, node->data.for_stmt.condition);
+            optimize_node(optimizer, node->data.for_stmt.update);
+            optimize_node(optimizer, node->data.for_stmt.body);
+            break;
+
+        case NODE_RETURN:
+            optimize_node(optimizer, node->data.return_stmt.value);
+            break;
+
+        case NODE_BLOCK:
+        case NODE_PROGRAM:
+            for (int i = 0; i < node->data.block.count; i++) {
+                optimize_node(optimizer, node->data.block.statements[i]);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+void optimize_program(ASTNode* program) {
+    SlotTable globals;
+    init_slot_table(&globals, program->data.block.global_count);
+    count_writes(&globals, NULL, program);
+    // Prelude code may write its globals at any time
+    for (int i = 0; i < program->data.block.inherited_globals; i++) {
+        globals.writes[i]++;
+    }
+
+    Optimizer optimizer = { &globals, NULL, true };
+    optimize_body(&optimizer, program);
+}
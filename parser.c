@@ -1,25 +1,45 @@
 #include "minall.h"
 
+// The parser pulls tokens from the lexer as it consumes them, so lexing
+// takes constant memory however long the script is. The last few tokens
+// are kept in a ring: a Token* stays valid for TOKEN_RING - 1 advances.
+//
+// The first token the grammar cannot use is a syntax error: it is reported
+// with its position, every loop in the parser stops there, and parse()
+// returns NULL.
+#define TOKEN_RING 4
+
 typedef struct {
-    Token* tokens;
-    int count;
-    int current;
+    Lexer lexer;
+    Token ring[TOKEN_RING];
+    int current;            // tokens consumed so far
+    bool failed;            // a syntax error has been reported
 } Parser;
 
-static Token* current_token(Parser* parser) {
-    if (parser->current >= parser->count) {
-        return &parser->tokens[parser->count - 1]; // EOF token
-    }
-    return &parser->tokens[parser->current];
+static INLINE Token* current_token(Parser* parser) {
+    return &parser->ring[parser->current & (TOKEN_RING - 1)];
 }
 
 static Token* advance(Parser* parser) {
-    if (parser->current < parser->count - 1) {
+    if (current_token(parser)->type != TOKEN_EOF) {
         parser->current++;
+        lexer_next(&parser->lexer, current_token(parser));
     }
     return current_token(parser);
 }
 
+// Returns items with room for one more than count, doubling the capacity
+// when it is full
+static void* reserve(void* items, int count, int* capacity, size_t size) {
+    if (count < *capacity) {
+        return items;
+    }
+    void* grown = minall_malloc(*capacity * 2 * size);
+    memcpy(grown, items, count * size);
+    *capacity *= 2;
+    return grown;
+}
+
 static bool match(Parser* parser, TokenType type) {
     if (current_token(parser)->type == type) {
         advance(parser);
@@ -28,8 +48,28 @@ static bool match(Parser* parser, TokenType type) {
     return false;
 }
 
+// Reports the first syntax error; returns NULL for the caller to pass on
+static ASTNode* syntax_error(Parser* parser, const char* expected) {
+    if (!parser->failed) {
+        Token* token = current_token(parser);
+        fprintf(stderr, "Syntax error on line %d, column %d: expected %s\n",
+                token->line, token->column, expected);
+        parser->failed = true;
+    }
+    return NULL;
+}
+
+static bool expect(Parser* parser, TokenType type, const char* expected) {
+    if (match(parser, type)) {
+        return true;
+    }
+    syntax_error(parser, expected);
+    return false;
+}
+
 static ASTNode* create_node(NodeType type) {
     ASTNode* node = (ASTNode*)minall_malloc(sizeof(ASTNode));
+    memset(node, 0, sizeof(ASTNode));
     node->type = type;
     return node;
 }
@@ -49,23 +89,29 @@ static ASTNode* parse_call(Parser* parser);
 static ASTNode* parse_primary(Parser* parser);
 
 static ASTNode* parse_block(Parser* parser) {
-    if (!match(parser, TOKEN_LBRACE)) {
+    if (!expect(parser, TOKEN_LBRACE, "'{'")) {
         return NULL;
     }
     
     ASTNode* block = create_node(NODE_BLOCK);
-    block->data.block.statements = (ASTNode**)minall_malloc(100 * sizeof(ASTNode*));
+    int capacity = 16;
+    block->data.block.statements = (ASTNode**)minall_malloc(capacity * sizeof(ASTNode*));
     block->data.block.count = 0;
     
-    while (current_token(parser)->type != TOKEN_RBRACE && 
+    while (!parser->failed &&
+           current_token(parser)->type != TOKEN_RBRACE && 
            current_token(parser)->type != TOKEN_EOF) {
         ASTNode* stmt = parse_statement(parser);
         if (stmt) {
+            block->data.block.statements = (ASTNode**)reserve(
+                block->data.block.statements, block->data.block.count, &capacity, sizeof(ASTNode*));
             block->data.block.statements[block->data.block.count++] = stmt;
         }
     }
     
-    match(parser, TOKEN_RBRACE);
+    if (!expect(parser, TOKEN_RBRACE, "'}'")) {
+        return NULL;
+    }
     return block;
 }
 
@@ -73,12 +119,12 @@ static ASTNode* parse_var_declaration(Parser* parser) {
     advance(parser); // consume 'var'
     
     if (current_token(parser)->type != TOKEN_IDENTIFIER) {
-        return NULL;
+        return syntax_error(parser, "a variable name");
     }
     
     ASTNode* node = create_node(NODE_VAR_DECLARATION);
-    node->data.var_decl.name = (char*)minall_malloc(strlen(current_token(parser)->value) + 1);
-    strcpy(node->data.var_decl.name, current_token(parser)->value);
+    node->data.var_decl.name = current_token(parser)->value;
+    node->data.var_decl.slot = -1;
     
     advance(parser);
     
@@ -96,57 +142,60 @@ static ASTNode* parse_function_declaration(Parser* parser) {
     advance(parser); // consume 'function'
     
     if (current_token(parser)->type != TOKEN_IDENTIFIER) {
-        return NULL;
+        return syntax_error(parser, "a function name");
     }
     
     ASTNode* node = create_node(NODE_FUNCTION_DECLARATION);
-    node->data.func_decl.name = (char*)minall_malloc(strlen(current_token(parser)->value) + 1);
-    strcpy(node->data.func_decl.name, current_token(parser)->value);
+    node->data.func_decl.name = current_token(parser)->value;
+    node->data.func_decl.local_count = 0;
+    node->data.func_decl.function_index = -1;
     
     advance(parser);
     
-    if (!match(parser, TOKEN_LPAREN)) {
+    if (!expect(parser, TOKEN_LPAREN, "'('")) {
         return NULL;
     }
     
-    node->data.func_decl.params = (char**)minall_malloc(10 * sizeof(char*));
+    int capacity = 8;
+    node->data.func_decl.params = (Atom**)minall_malloc(capacity * sizeof(Atom*));
     node->data.func_decl.param_count = 0;
     
     while (current_token(parser)->type != TOKEN_RPAREN && 
            current_token(parser)->type != TOKEN_EOF) {
         if (current_token(parser)->type == TOKEN_IDENTIFIER) {
-            node->data.func_decl.params[node->data.func_decl.param_count] = 
-                (char*)minall_malloc(strlen(current_token(parser)->value) + 1);
-            strcpy(node->data.func_decl.params[node->data.func_decl.param_count], 
-                   current_token(parser)->value);
-            node->data.func_decl.param_count++;
+            node->data.func_decl.params = (Atom**)reserve(
+                node->data.func_decl.params, node->data.func_decl.param_count, &capacity, sizeof(Atom*));
+            node->data.func_decl.params[node->data.func_decl.param_count++] = 
+                current_token(parser)->value;
             advance(parser);
             
-            if (current_token(parser)->type == TOKEN_COMMA) {
-                advance(parser);
+            if (!match(parser, TOKEN_COMMA)) {
+                break;
             }
         } else {
-            break;
+            return syntax_error(parser, "a parameter name");
         }
     }
     
-    match(parser, TOKEN_RPAREN);
+    if (!expect(parser, TOKEN_RPAREN, "')'")) {
+        return NULL;
+    }
     node->data.func_decl.body = parse_block(parser);
     
-    return node;
+    return node->data.func_decl.body ? node : NULL;
 }
 
 static ASTNode* parse_if_statement(Parser* parser) {
     advance(parser); // consume 'if'
     
-    if (!match(parser, TOKEN_LPAREN)) {
+    if (!expect(parser, TOKEN_LPAREN, "'('")) {
         return NULL;
     }
     
     ASTNode* node = create_node(NODE_IF);
     node->data.if_stmt.condition = parse_expression(parser);
     
-    if (!match(parser, TOKEN_RPAREN)) {
+    if (!expect(parser, TOKEN_RPAREN, "')'")) {
         return NULL;
     }
     
@@ -165,14 +214,14 @@ static ASTNode* parse_if_statement(Parser* parser) {
 static ASTNode* parse_while_statement(Parser* parser) {
     advance(parser); // consume 'while'
     
-    if (!match(parser, TOKEN_LPAREN)) {
+    if (!expect(parser, TOKEN_LPAREN, "'('")) {
         return NULL;
     }
     
     ASTNode* node = create_node(NODE_WHILE);
     node->data.while_stmt.condition = parse_expression(parser);
     
-    if (!match(parser, TOKEN_RPAREN)) {
+    if (!expect(parser, TOKEN_RPAREN, "')'")) {
         return NULL;
     }
     
@@ -181,6 +230,42 @@ static ASTNode* parse_while_statement(Parser* parser) {
     return node;
 }
 
+static ASTNode* parse_for_statement(Parser* parser) {
+    advance(parser); // consume 'for'
+    
+    if (!expect(parser, TOKEN_LPAREN, "'('")) {
+        return NULL;
+    }
+    
+    ASTNode* node = create_node(NODE_FOR);
+    node->data.for_stmt.fast_loop = NULL;
+    node->data.for_stmt.fast_checked = false;
+    
+    // Initializer; a `var` declaration consumes its own semicolon
+    if (current_token(parser)->type == TOKEN_VAR) {
+        node->data.for_stmt.init = parse_var_declaration(parser);
+    } else {
+        node->data.for_stmt.init = current_token(parser)->type != TOKEN_SEMICOLON
+            ? parse_expression(parser) : NULL;
+        match(parser, TOKEN_SEMICOLON);
+    }
+    
+    node->data.for_stmt.condition = current_token(parser)->type != TOKEN_SEMICOLON
+        ? parse_expression(parser) : NULL;
+    match(parser, TOKEN_SEMICOLON);
+    
+    node->data.for_stmt.update = current_token(parser)->type != TOKEN_RPAREN
+        ? parse_expression(parser) : NULL;
+    
+    if (!expect(parser, TOKEN_RPAREN, "')'")) {
+        return NULL;
+    }
+    
+    node->data.for_stmt.body = parse_statement(parser);
+    
+    return node;
+}
+
 static ASTNode* parse_return_statement(Parser* parser) {
     advance(parser); // consume 'return'
     
@@ -206,10 +291,15 @@ static ASTNode* parse_statement(Parser* parser) {
             return parse_if_statement(parser);
         case TOKEN_WHILE:
             return parse_while_statement(parser);
+        case TOKEN_FOR:
+            return parse_for_statement(parser);
         case TOKEN_RETURN:
             return parse_return_statement(parser);
         case TOKEN_LBRACE:
             return parse_block(parser);
+        case TOKEN_SEMICOLON:
+            advance(parser); // empty statement
+            return NULL;
         default: {
             ASTNode* expr = parse_expression(parser);
             match(parser, TOKEN_SEMICOLON);
@@ -230,7 +320,6 @@ static ASTNode* parse_assignment(Parser* parser) {
         ASTNode* node = create_node(NODE_ASSIGNMENT);
         node->data.binary_op.left = expr;
         node->data.binary_op.right = parse_assignment(parser);
-        node->data.binary_op.operator = "=";
         return node;
     }
     
@@ -245,7 +334,7 @@ static ASTNode* parse_logical_or(Parser* parser) {
         ASTNode* node = create_node(NODE_BINARY_OP);
         node->data.binary_op.left = expr;
         node->data.binary_op.right = parse_logical_and(parser);
-        node->data.binary_op.operator = "||";
+        node->data.binary_op.operator = BINARY_OR;
         expr = node;
     }
     
@@ -260,7 +349,7 @@ static ASTNode* parse_logical_and(Parser* parser) {
         ASTNode* node = create_node(NODE_BINARY_OP);
         node->data.binary_op.left = expr;
         node->data.binary_op.right = parse_equality(parser);
-        node->data.binary_op.operator = "&&";
+        node->data.binary_op.operator = BINARY_AND;
         expr = node;
     }
     
@@ -277,7 +366,7 @@ static ASTNode* parse_equality(Parser* parser) {
         ASTNode* node = create_node(NODE_BINARY_OP);
         node->data.binary_op.left = expr;
         node->data.binary_op.right = parse_relational(parser);
-        node->data.binary_op.operator = (op == TOKEN_EQUAL) ? "==" : "!=";
+        node->data.binary_op.operator = (op == TOKEN_EQUAL) ? BINARY_EQ : BINARY_NE;
         expr = node;
     }
     
@@ -298,10 +387,10 @@ static ASTNode* parse_relational(Parser* parser) {
         node->data.binary_op.right = parse_additive(parser);
         
         switch (op) {
-            case TOKEN_LESS: node->data.binary_op.operator = "<"; break;
-            case TOKEN_GREATER: node->data.binary_op.operator = ">"; break;
-            case TOKEN_LESS_EQUAL: node->data.binary_op.operator = "<="; break;
-            case TOKEN_GREATER_EQUAL: node->data.binary_op.operator = ">="; break;
+            case TOKEN_LESS: node->data.binary_op.operator = BINARY_LT; break;
+            case TOKEN_GREATER: node->data.binary_op.operator = BINARY_GT; break;
+            case TOKEN_LESS_EQUAL: node->data.binary_op.operator = BINARY_LE; break;
+            case TOKEN_GREATER_EQUAL: node->data.binary_op.operator = BINARY_GE; break;
             default: break;
         }
         expr = node;
@@ -320,7 +409,7 @@ static ASTNode* parse_additive(Parser* parser) {
         ASTNode* node = create_node(NODE_BINARY_OP);
         node->data.binary_op.left = expr;
         node->data.binary_op.right = parse_multiplicative(parser);
-        node->data.binary_op.operator = (op == TOKEN_PLUS) ? "+" : "-";
+        node->data.binary_op.operator = (op == TOKEN_PLUS) ? BINARY_ADD : BINARY_SUB;
         expr = node;
     }
     
@@ -340,9 +429,9 @@ static ASTNode* parse_multiplicative(Parser* parser) {
         node->data.binary_op.right = parse_unary(parser);
         
         switch (op) {
-            case TOKEN_MULTIPLY: node->data.binary_op.operator = "*"; break;
-            case TOKEN_DIVIDE: node->data.binary_op.operator = "/"; break;
-            case TOKEN_MODULO: node->data.binary_op.operator = "%"; break;
+            case TOKEN_MULTIPLY: node->data.binary_op.operator = BINARY_MUL; break;
+            case TOKEN_DIVIDE: node->data.binary_op.operator = BINARY_DIV; break;
+            case TOKEN_MODULO: node->data.binary_op.operator = BINARY_MOD; break;
             default: break;
         }
         expr = node;
@@ -358,7 +447,7 @@ static ASTNode* parse_unary(Parser* parser) {
         advance(parser);
         ASTNode* node = create_node(NODE_UNARY_OP);
         node->data.unary_op.operand = parse_unary(parser);
-        node->data.unary_op.operator = (op == TOKEN_NOT) ? "!" : "-";
+        node->data.unary_op.operator = (op == TOKEN_NOT) ? UNARY_NOT : UNARY_NEG;
         return node;
     }
     
@@ -372,19 +461,26 @@ static ASTNode* parse_call(Parser* parser) {
         advance(parser);
         ASTNode* node = create_node(NODE_CALL);
         node->data.call.function = expr;
-        node->data.call.args = (ASTNode**)minall_malloc(10 * sizeof(ASTNode*));
+        int capacity = 8;
+        node->data.call.args = (ASTNode**)minall_malloc(capacity * sizeof(ASTNode*));
         node->data.call.arg_count = 0;
+        node->data.call.target = CALL_UNRESOLVED;
         
-        while (current_token(parser)->type != TOKEN_RPAREN && 
+        while (!parser->failed &&
+               current_token(parser)->type != TOKEN_RPAREN && 
                current_token(parser)->type != TOKEN_EOF) {
+            node->data.call.args = (ASTNode**)reserve(
+                node->data.call.args, node->data.call.arg_count, &capacity, sizeof(ASTNode*));
             node->data.call.args[node->data.call.arg_count++] = parse_expression(parser);
             
-            if (current_token(parser)->type == TOKEN_COMMA) {
-                advance(parser);
+            if (!match(parser, TOKEN_COMMA)) {
+                break;
             }
         }
         
-        match(parser, TOKEN_RPAREN);
+        if (!expect(parser, TOKEN_RPAREN, "')'")) {
+            return NULL;
+        }
         expr = node;
     }
     
@@ -404,45 +500,62 @@ static ASTNode* parse_primary(Parser* parser) {
         case TOKEN_STRING: {
             advance(parser);
             ASTNode* node = create_node(NODE_STRING);
-            node->data.string = (char*)minall_malloc(strlen(token->value) + 1);
-            strcpy(node->data.string, token->value);
+            node->data.string.atom = token->value;
+            node->data.string.value = string_from_atom(token->value);
             return node;
         }
         case TOKEN_IDENTIFIER: {
             advance(parser);
             ASTNode* node = create_node(NODE_IDENTIFIER);
-            node->data.identifier = (char*)minall_malloc(strlen(token->value) + 1);
-            strcpy(node->data.identifier, token->value);
+            node->data.identifier.name = token->value;
+            node->data.identifier.slot = -1;
             return node;
         }
         case TOKEN_LPAREN: {
             advance(parser);
             ASTNode* expr = parse_expression(parser);
-            match(parser, TOKEN_RPAREN);
+            if (!expect(parser, TOKEN_RPAREN, "')'")) {
+                return NULL;
+            }
             return expr;
         }
         default:
-            return NULL;
+            return syntax_error(parser, "an expression");
     }
 }
 
-ASTNode* parse(Token* tokens, int token_count) {
-    Parser parser = {tokens, token_count, 0};
+ASTNode* parse(const char* source) {
+    Parser parser;
+    lexer_init(&parser.lexer, source);
+    parser.current = 0;
+    parser.failed = false;
+    lexer_next(&parser.lexer, current_token(&parser));
     
     ASTNode* program = create_node(NODE_PROGRAM);
-    program->data.block.statements = (ASTNode**)minall_malloc(100 * sizeof(ASTNode*));
+    int capacity = 16;
+    program->data.block.statements = (ASTNode**)minall_malloc(capacity * sizeof(ASTNode*));
     program->data.block.count = 0;
+    program->data.block.global_names = NULL;
+    program->data.block.global_count = 0;
+    program->data.block.function_names = NULL;
+    program->data.block.function_count = 0;
     
-    while (current_token(&parser)->type != TOKEN_EOF) {
+    while (!parser.failed && current_token(&parser)->type != TOKEN_EOF) {
         ASTNode* stmt = parse_statement(&parser);
         if (stmt) {
+            program->data.block.statements = (ASTNode**)reserve(
+                program->data.block.statements, program->data.block.count, &capacity, sizeof(ASTNode*));
             program->data.block.statements[program->data.block.count++] = stmt;
         }
     }
     
-    return program;
+    return parser.failed ? NULL : program;
 }
 
+static const char* binary_operator_names[] = {
+    "+", "-", "*", "/", "%", "<", "<=", ">", ">=", "==", "!=", "&&", "||"
+};
+
 void print_ast(ASTNode* node, int depth) {
     if (!node) return;
     
@@ -457,23 +570,27 @@ void print_ast(ASTNode* node, int depth) {
             }
             break;
         case NODE_VAR_DECLARATION:
-            printf("VarDecl: %s\n", node->data.var_decl.name);
+            printf("VarDecl: %.*s\n", (int)node->data.var_decl.name->length,
+                   node->data.var_decl.name->chars);
             if (node->data.var_decl.value) {
                 print_ast(node->data.var_decl.value, depth + 1);
             }
             break;
         case NODE_FUNCTION_DECLARATION:
-            printf("FuncDecl: %s (%d params)\n", 
-                   node->data.func_decl.name, node->data.func_decl.param_count);
+            printf("FuncDecl: %.*s (%d params)\n", (int)node->data.func_decl.name->length,
+                   node->data.func_decl.name->chars, node->data.func_decl.param_count);
             print_ast(node->data.func_decl.body, depth + 1);
             break;
         case NODE_BINARY_OP:
-            printf("BinaryOp: %s\n", node->data.binary_op.operator);
+        case NODE_BINARY_NUMERIC:
+        case NODE_BINARY_VAR_CONST:
+        case NODE_BINARY_VAR_VAR:
+            printf("BinaryOp: %s\n", binary_operator_names[node->data.binary_op.operator]);
             print_ast(node->data.binary_op.left, depth + 1);
             print_ast(node->data.binary_op.right, depth + 1);
             break;
         case NODE_UNARY_OP:
-            printf("UnaryOp: %s\n", node->data.unary_op.operator);
+            printf("UnaryOp: %s\n", node->data.unary_op.operator == UNARY_NEG ? "-" : "!");
             print_ast(node->data.unary_op.operand, depth + 1);
             break;
         case NODE_CALL:
@@ -496,6 +613,13 @@ void print_ast(ASTNode* node, int depth) {
             print_ast(node->data.while_stmt.condition, depth + 1);
             print_ast(node->data.while_stmt.body, depth + 1);
             break;
+        case NODE_FOR:
+            printf("For\n");
+            print_ast(node->data.for_stmt.init, depth + 1);
+            print_ast(node->data.for_stmt.condition, depth + 1);
+            print_ast(node->data.for_stmt.update, depth + 1);
+            print_ast(node->data.for_stmt.body, depth + 1);
+            break;
         case NODE_RETURN:
             printf("Return\n");
             if (node->data.return_stmt.value) {
@@ -503,13 +627,15 @@ void print_ast(ASTNode* node, int depth) {
             }
             break;
         case NODE_IDENTIFIER:
-            printf("Identifier: %s\n", node->data.identifier);
+            printf("Identifier: %.*s\n", (int)node->data.identifier.name->length,
+                   node->data.identifier.name->chars);
             break;
         case NODE_NUMBER:
             printf("Number: %.2f\n", node->data.number);
             break;
         case NODE_STRING:
-            printf("String: %s\n", node->data.string);
+            printf("String: %.*s\n", (int)node->data.string.atom->length,
+                   node->data.string.atom->chars);
             break;
         default:
             printf("Unknown node type\n");
@@ -0,0 +1,319 @@
+#include "minall.h"
+
+// Scope resolution - runs once after parse() and stores a slot index in
+// every identifier and `var` node, so neither engine looks names up at run
+// time. It also links each call site to a function index or builtin.
+//
+// Scoping follows JavaScript: parameters and `var` declarations inside a
+// function body are frame slots, every other name is a global. Function
+// bodies do not see the locals of an enclosing function.
+//
+// Function names live in their own program-wide namespace. Every distinct
+// name gets one function index; all declarations of that name share it, so
+// executing a later declaration rebinds the index without relinking.
+//
+// A scope holds at most MAX_VARIABLES names. Past that the resolve fails
+// and the program is not run, rather than handing out a slot that is
+// already taken.
+
+typedef struct {
+    Atom* names[MAX_VARIABLES];
+    int count;
+    bool full;          // a name did not fit
+} Scope;
+
+typedef struct {
+    Atom** names;
+    int count;
+    int capacity;
+} FunctionTable;
+
+typedef struct {
+    Scope* globals;
+    Scope* locals;      // NULL at the top level
+    FunctionTable* functions;
+    bool failed;        // some function's locals did not fit
+} Resolver;
+
+static void resolve_node(Resolver* resolver, ASTNode* node);
+
+static int find_name(Scope* scope, Atom* name) {
+    for (int i = 0; i < scope->count; i++) {
+        if (scope->names[i] == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int declare_name(Scope* scope, Atom* name) {
+    int slot = find_name(scope, name);
+    if (slot >= 0) return slot;
+
+    if (scope->count >= MAX_VARIABLES) {
+        if (!scope->full) {
+            fprintf(stderr, "Error: More than %d variables in one scope at %.*s\n",
+                    MAX_VARIABLES, (int)name->length, name->chars);
+            scope->full = true;
+        }
+        return 0;
+    }
+    scope->names[scope->count] = name;
+    return scope->count++;
+}
+
+static void resolve_name(Resolver* resolver, Atom* name, int* slot, bool* is_global) {
+    if (resolver->locals) {
+        int local = find_name(resolver->locals, name);
+        if (local >= 0) {
+            *slot = local;
+            *is_global = false;
+            return;
+        }
+    }
+    *slot = declare_name(resolver->globals, name);
+    *is_global = true;
+}
+
+static int find_function(FunctionTable* table, Atom* name) {
+    for (int i = 0; i < table->count; i++) {
+        if (table->names[i] == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int declare_function(FunctionTable* table, Atom* name) {
+    int index = find_function(table, name);
+    if (index >= 0) return index;
+
+    if (table->count == table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 16;
+        Atom** names = (Atom**)minall_malloc(capacity * sizeof(Atom*));
+        if (table->count) {
+            memcpy(names, table->names, table->count * sizeof(Atom*));
+        }
+        table->names = names;
+        table->capacity = capacity;
+    }
+    table->names[table->count] = name;
+    return table->count++;
+}
+
+// Give every function declaration in the tree its function index, so calls
+// can be linked to functions declared later in the source.
+static void hoist_functions(FunctionTable* table, ASTNode* node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case NODE_FUNCTION_DECLARATION:
+            node->data.func_decl.function_index = declare_function(table, node->data.func_decl.name);
+            hoist_functions(table, node->data.func_decl.body);
+            break;
+        case NODE_BLOCK:
+        case NODE_PROGRAM:
+            for (int i = 0; i < node->data.block.count; i++) {
+                hoist_functions(table, node->data.block.statements[i]);
+            }
+            break;
+        case NODE_IF:
+            hoist_functions(table, node->data.if_stmt.then_branch);
+            hoist_functions(table, node->data.if_stmt.else_branch);
+            break;
+        case NODE_WHILE:
+            hoist_functions(table, node->data.while_stmt.body);
+            break;
+        case NODE_FOR:
+            hoist_functions(table, node->data.for_stmt.body);
+            break;
+        default:
+            break;
+    }
+}
+
+static void link_call(Resolver* resolver, ASTNode* node) {
+    ASTNode* callee = node->data.call.function;
+    if (callee->type != NODE_IDENTIFIER) {
+        node->data.call.target = CALL_UNRESOLVED;
+        return;
+    }
+
+    // User functions shadow natives, and natives builtins, of the same name
+    Atom* name = callee->data.identifier.name;
+    int index = find_function(resolver->functions, name);
+    int native = index < 0 ? minall_find_native(name) : -1;
+    if (index >= 0) {
+        node->data.call.target = index;
+    } else if (native >= 0) {
+        node->data.call.target = CALL_NATIVE_BASE - native;
+    } else if (name == minall_current->atoms.print) {
+        node->data.call.target = CALL_BUILTIN_PRINT;
+    } else {
+        node->data.call.target = CALL_UNRESOLVED;
+    }
+}
+
+// Collect `var` declarations of a function body into frame slots, without
+// descending into nested function declarations.
+static void hoist_locals(Scope* scope, ASTNode* node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case NODE_VAR_DECLARATION:
+            declare_name(scope, node->data.var_decl.name);
+            break;
+        case NODE_BLOCK:
+        case NODE_PROGRAM:
+            for (int i = 0; i < node->data.block.count; i++) {
+                hoist_locals(scope, node->data.block.statements[i]);
+            }
+            break;
+        case NODE_IF:
+            hoist_locals(scope, node->data.if_stmt.then_branch);
+            hoist_locals(scope, node->data.if_stmt.else_branch);
+            break;
+        case NODE_WHILE:
+            hoist_locals(scope, node->data.while_stmt.body);
+            break;
+        case NODE_FOR:
+            hoist_locals(scope, node->data.for_stmt.init);
+            hoist_locals(scope, node->data.for_stmt.body);
+            break;
+        default:
+            break;
+    }
+}
+
+static void resolve_function(Resolver* resolver, ASTNode* node) {
+    Scope locals;
+    locals.count = 0;
+    locals.full = false;
+
+    for (int i = 0; i < node->data.func_decl.param_count; i++) {
+        declare_name(&locals, node->data.func_decl.params[i]);
+    }
+    hoist_locals(&locals, node->data.func_decl.body);
+    node->data.func_decl.local_count = locals.count;
+
+    Resolver inner = { resolver->globals, &locals, resolver->functions, false };
+    resolve_node(&inner, node->data.func_decl.body);
+    if (locals.full || inner.failed) {
+        resolver->failed = true;
+    }
+}
+
+static void resolve_node(Resolver* resolver, ASTNode* node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            resolve_name(resolver, node->data.identifier.name,
+                         &node->data.identifier.slot, &node->data.identifier.is_global);
+            break;
+
+        case NODE_VAR_DECLARATION:
+            resolve_node(resolver, node->data.var_decl.value);
+            resolve_name(resolver, node->data.var_decl.name,
+                         &node->data.var_decl.slot, &node->data.var_decl.is_global);
+            break;
+
+        case NODE_FUNCTION_DECLARATION:
+            resolve_function(resolver, node);
+            break;
+
+        case NODE_ASSIGNMENT:
+        case NODE_BINARY_OP:
+        case NODE_BINARY_NUMERIC:
+        case NODE_BINARY_VAR_CONST:
+        case NODE_BINARY_VAR_VAR:
+            resolve_node(resolver, node->data.binary_op.left);
+            resolve_node(resolver, node->data.binary_op.right);
+            break;
+
+        case NODE_UNARY_OP:
+            resolve_node(resolver, node->data.unary_op.operand);
+            break;
+
+        case NODE_CALL:
+            // Callees are bound by function name, not through variables
+            link_call(resolver, node);
+            if (node->data.call.function->type != NODE_IDENTIFIER) {
+                resolve_node(resolver, node->data.call.function);
+            }
+            for (int i = 0; i < node->data.call.arg_count; i++) {
+                resolve_node(resolver, node->data.call.args[i]);
+            }
+            break;
+
+        case NODE_IF:
+            resolve_node(resolver, node->data.if_stmt.condition);
+            resolve_node(resolver, node->data.if_stmt.then_branch);
+            resolve_node(resolver, node->data.if_stmt.else_branch);
+            break;
+
+        case NODE_WHILE:
+            resolve_node(resolver, node->data.while_stmt.condition);
+            resolve_node(resolver, node->data.while_stmt.body);
+            break;
+
+        case NODE_FOR:
+            resolve_node(resolver, node->data.for_stmt.init);
+            resolve_node(resolver, node->data.for_stmt.condition);
+            resolve_node(resolver, node->data.for_stmt.update);
+            resolve_node(resolver, node->data.for_stmt.body);
+            break;
+
+        case NODE_RETURN:
+            resolve_node(resolver, node->data.return_stmt.value);
+            break;
+
+        case NODE_BLOCK:
+        case NODE_PROGRAM:
+            for (int i = 0; i < node->data.block.count; i++) {
+                resolve_node(resolver, node->data.block.statements[i]);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+bool resolve_program(ASTNode* program) {
+    return resolve_program_after(program, NULL);
+}
+
+// Resolves a program that runs in the context a prelude program left
+// behind (see snapshot.c): the prelude's globals and functions keep their
+// slots and indices, and new names are numbered after them.
+bool resolve_program_after(ASTNode* program, ASTNode* prelude) {
+    Scope globals;
+    globals.count = 0;
+    globals.full = false;
+
+    FunctionTable functions = { NULL, 0, 0 };
+    if (prelude) {
+        globals.count = prelude->data.block.global_count;
+        memcpy(globals.names, prelude->data.block.global_names, globals.count * sizeof(Atom*));
+        // Already distinct, so no need to look each one up
+        functions.count = functions.capacity = prelude->data.block.function_count;
+        functions.names = prelude->data.block.function_names;
+    }
+    program->data.block.inherited_globals = globals.count;
+    program->data.block.inherited_functions = functions.count;
+    hoist_functions(&functions, program);
+
+    Resolver resolver = { &globals, NULL, &functions, false };
+    resolve_node(&resolver, program);
+    if (globals.full || resolver.failed) {
+        return false;
+    }
+
+    program->data.block.global_count = globals.count;
+    program->data.block.global_names = (Atom**)minall_malloc((globals.count + 1) * sizeof(Atom*));
+    memcpy(program->data.block.global_names, globals.names, globals.count * sizeof(Atom*));
+    program->data.block.function_names = functions.names;
+    program->data.block.function_count = functions.count;
+    return true;
+}
@@ -0,0 +1,178 @@
+// fileno, fstat, sysconf and getpid are not part of C99
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "minall.h"
+
+// Heap snapshots
+//
+// Everything a program leaves behind lives in the two arenas: its AST,
+// atoms and functions in the compile arena, its strings in the value
+// arena. The only state outside them is the global part of the Context and
+// a few roots (the atom table, the GC threshold). A snapshot written after
+// a prelude has run holds those roots plus a byte-for-byte image of both
+// arenas. The arenas sit at fixed addresses (see memory.c), so the images
+// are mapped back copy-on-write at the same addresses and every pointer in
+// them is valid as it stands: restoring costs a few mmap calls whatever the
+// size of the prelude, and pages are only read in as the main script
+// touches them.
+//
+// The main script is then resolved after the prelude program
+// (resolve_program_after) and runs in the restored Context, seeing the
+// prelude's globals and functions. Snapshots are tied to the binary that
+// wrote them: the header records the runtime version and the sizes of the
+// structures the images are made of. They hold tree-walker state only.
+//
+// Layout: SnapshotHeader, the global Variables, then the compile arena
+// image and the value arena image, each starting on a page boundary.
+
+#define SNAPSHOT_MAGIC "MINALLSN"
+#define SNAPSHOT_FORMAT 1
+
+typedef struct {
+    char magic[8];
+    uint32_t format;
+    uint32_t page_size;
+    char version[16];               // MINALL_VERSION
+    uint32_t value_size;            // sizeof(Value)
+    uint32_t string_size;           // sizeof(String)
+    uint32_t node_size;             // sizeof(ASTNode)
+    uint32_t variable_size;         // sizeof(Variable)
+    HeapState heap;
+    AtomTable atoms;
+    size_t gc_threshold;
+    ASTNode* prelude;
+    Function* functions;
+    int func_count;
+    int func_capacity;
+    int var_count;
+    int padding;
+    uint64_t compile_at;            // file offsets of the arena images
+    uint64_t value_at;
+} SnapshotHeader;
+
+static void snapshot_header(SnapshotHeader* header) {
+    memset(header, 0, sizeof(SnapshotHeader));
+    memcpy(header->magic, SNAPSHOT_MAGIC, 8);
+    header->format = SNAPSHOT_FORMAT;
+    header->page_size = (uint32_t)sysconf(_SC_PAGESIZE);
+    strncpy(header->version, MINALL_VERSION, sizeof(header->version) - 1);
+    header->value_size = sizeof(Value);
+    header->string_size = sizeof(String);
+    header->node_size = sizeof(ASTNode);
+    header->variable_size = sizeof(Variable);
+}
+
+static INLINE uint64_t page_align(uint64_t offset, uint64_t page) {
+    return (offset + page - 1) & ~(page - 1);
+}
+
+// Writes size bytes at offset, zero-filling from the current position
+static bool snapshot_put(FILE* file, uint64_t* position, uint64_t offset,
+                         const void* data, size_t size) {
+    while (*position < offset) {
+        if (fputc(0, file) == EOF) return false;
+        (*position)++;
+    }
+    if (size && fwrite(data, 1, size, file) != size) return false;
+    *position += size;
+    return true;
+}
+
+// Saves the state prelude left in ctx; call between programs, when no
+// call or loop region is open
+bool snapshot_write(const char* path, ASTNode* prelude, Context* ctx) {
+    SnapshotHeader header;
+    snapshot_header(&header);
+    if (!minall_heap_state(&header.heap)) {
+        fprintf(stderr, "Error: The heap is not at its fixed address and cannot be saved\n");
+        return false;
+    }
+    atom_table_state(&header.atoms);
+    header.gc_threshold = minall_current->gc.threshold;
+    header.prelude = prelude;
+    header.functions = ctx->functions;
+    header.func_count = ctx->func_count;
+    header.func_capacity = ctx->func_capacity;
+    header.var_count = ctx->var_count;
+
+    uint64_t page = header.page_size;
+    size_t variables_size = ctx->var_count * sizeof(Variable);
+    header.compile_at = page_align(sizeof(SnapshotHeader) + variables_size, page);
+    header.value_at = page_align(header.compile_at + header.heap.compile_saved, page);
+
+    size_t temp_size = strlen(path) + 32;
+    char* temp = (char*)malloc(temp_size);
+    if (!temp) return false;
+    snprintf(temp, temp_size, "%s.%ld.tmp", path, (long)getpid());
+
+    FILE* file = fopen(temp, "wb");
+    bool ok = file != NULL;
+    uint64_t position = 0;
+    ok = ok && snapshot_put(file, &position, 0, &header, sizeof(SnapshotHeader)) &&
+         snapshot_put(file, &position, position, ctx->variables, variables_size) &&
+         snapshot_put(file, &position, header.compile_at,
+                      header.heap.compile_base, header.heap.compile_saved) &&
+         snapshot_put(file, &position, header.value_at,
+                      header.heap.value_base, header.heap.value_offset);
+    if (file) {
+        ok = fclose(file) == 0 && ok;
+    }
+    ok = ok && rename(temp, path) == 0;
+    if (!ok) {
+        remove(temp);
+        fprintf(stderr, "Error: Could not write snapshot %s\n", path);
+    }
+    free(temp);
+    return ok;
+}
+
+// Restores a snapshot into the current isolate, which must hold the fixed
+// heap address and not have allocated yet, leaving the prelude program in
+// *prelude and its globals in ctx
+bool snapshot_load(const char* path, ASTNode** prelude, Context* ctx) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open snapshot %s\n", path);
+        return false;
+    }
+
+    SnapshotHeader header;
+    SnapshotHeader expected;
+    snapshot_header(&expected);
+    bool ok = fread(&header, sizeof(SnapshotHeader), 1, file) == 1 &&
+              memcmp(&header, &expected, offsetof(SnapshotHeader, heap)) == 0 &&
+              header.var_count >= 0 && header.var_count <= MAX_VARIABLES;
+    if (!ok) {
+        fprintf(stderr, "Error: %s is not a snapshot from this runtime\n", path);
+        fclose(file);
+        return false;
+    }
+
+    // Mapping past the end of the file would fault on first touch
+    struct stat info;
+    init_context(ctx);
+    ok = fstat(fileno(file), &info) == 0 &&
+         (uint64_t)info.st_size >= header.value_at + header.heap.value_offset &&
+         fread(ctx->variables, sizeof(Variable), header.var_count, file) == (size_t)header.var_count;
+    if (ok && !minall_heap_restore(&header.heap, fileno(file), header.compile_at, header.value_at)) {
+        fprintf(stderr, "Error: Could not map snapshot %s at its heap addresses\n", path);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "Error: Snapshot %s is cut short\n", path);
+        return false;
+    }
+
+    atom_table_restore(&header.atoms);
+    minall_current->gc.threshold = header.gc_threshold;
+    ctx->var_count = header.var_count;
+    ctx->functions = header.functions;
+    ctx->func_count = header.func_count;
+    ctx->func_capacity = header.func_capacity;
+    *prelude = header.prelude;
+    return true;
+}
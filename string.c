@@ -0,0 +1,131 @@
+#include "minall.h"
+
+// String values - length-prefixed, so nothing scans for the terminator and
+// nothing is truncated. Concatenating long strings allocates one rope node
+// instead of copying both sides; a rope is flattened into a single buffer
+// the first time its characters are needed (printing, constant folding) and
+// keeps that buffer, so building a string in a loop is amortized O(1) per
+// step. Strings built at run time live in the value arena; literal strings
+// share their atom and live with the AST.
+
+// Results shorter than this are copied flat; a rope node would cost about
+// as much as the copy
+#define ROPE_MIN_LENGTH 32
+
+static String* string_alloc(uint32_t length, char** chars) {
+    String* string = (String*)minall_value_malloc(sizeof(String) + length + 1);
+    *chars = (char*)(string + 1);
+    (*chars)[length] = '\0';
+
+    string->length = length;
+    string->is_rope = false;
+    string->forwarded = false;
+    string->data.chars = *chars;
+    return string;
+}
+
+String* string_from_chars(const char* chars, uint32_t length) {
+    char* copy;
+    String* string = string_alloc(length, &copy);
+    memcpy(copy, chars, length);
+    return string;
+}
+
+String* string_from_atom(Atom* atom) {
+    // Atoms are never freed or mutated, so share their characters
+    String* string = (String*)minall_malloc(sizeof(String));
+    string->length = atom->length;
+    string->is_rope = false;
+    string->forwarded = false;
+    string->data.chars = atom->chars;
+    return string;
+}
+
+String* string_from_number(double number) {
+    char buffer[64];
+    int length = snprintf(buffer, sizeof(buffer), "%.2f", number);
+    if (length < 0) length = 0;
+    if (length >= (int)sizeof(buffer)) length = sizeof(buffer) - 1;
+    return string_from_chars(buffer, (uint32_t)length);
+}
+
+// Writes the characters of string to dest. Recurses into the shorter half
+// of each rope and loops on the longer one, so the recursion depth stays
+// logarithmic in the length however lopsided the rope is.
+static void string_copy(String* string, char* dest) {
+    while (string->is_rope) {
+        String* left = string->data.rope.left;
+        String* right = string->data.rope.right;
+
+        if (left->length <= right->length) {
+            string_copy(left, dest);
+            dest += left->length;
+            string = right;
+        } else {
+            string_copy(right, dest + left->length);
+            string = left;
+        }
+    }
+    memcpy(dest, string->data.chars, string->length);
+}
+
+const char* string_chars(String* string) {
+    if (UNLIKELY(string->is_rope)) {
+        char* chars = (char*)minall_value_malloc(string->length + 1);
+        string_copy(string, chars);
+        chars[string->length] = '\0';
+
+        string->is_rope = false;
+        string->data.chars = chars;
+
+        // The rope may be older than the open regions, so its new buffer
+        // must survive them
+        minall_keep(chars + string->length + 1);
+    }
+    return string->data.chars;
+}
+
+// Writes string without flattening it in place, so printing allocates
+// nothing that outlives the call
+void string_print(String* string, FILE* out) {
+    if (!string->is_rope) {
+        fwrite(string->data.chars, 1, string->length, out);
+        return;
+    }
+
+    size_t mark = minall_mark();
+    char* chars = (char*)minall_value_malloc(string->length);
+    string_copy(string, chars);
+    fwrite(chars, 1, string->length, out);
+    minall_release(mark);
+}
+
+String* string_concat(String* left, String* right) {
+    if (left->length == 0) return right;
+    if (right->length == 0) return left;
+
+    // A rope costs nothing to build, but it has to fit in a length and be
+    // flattened in the value arena one day
+    size_t total = (size_t)left->length + right->length;
+    if (UNLIKELY(total >= UINT32_MAX || total >= minall_current->heap.limit)) {
+        minall_out_of_memory(sizeof(String) + total + 1);
+    }
+
+    uint32_t length = (uint32_t)total;
+    if (length < ROPE_MIN_LENGTH) {
+        // Both halves are shorter still, so neither can be a rope
+        char* chars;
+        String* string = string_alloc(length, &chars);
+        memcpy(chars, left->data.chars, left->length);
+        memcpy(chars + left->length, right->data.chars, right->length);
+        return string;
+    }
+
+    String* string = (String*)minall_value_malloc(sizeof(String));
+    string->length = length;
+    string->is_rope = true;
+    string->forwarded = false;
+    string->data.rope.left = left;
+    string->data.rope.right = right;
+    return string;
+}
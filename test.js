@@ -91,4 +91,70 @@ function square(x) {
 var nested_result = add(square(3), square(4));
 print("add(square(3), square(4)) =", nested_result);
 
+// Test 10: Hoisting - every declaration is bound before the script runs,
+// and the last declaration of a name wins
+print("\nTest 10: Hoisting");
+print("later() =", later());
+function later() {
+    return "declared below";
+}
+
+function version() {
+    return 1;
+}
+print("version() =", version());
+function version() {
+    return 2;
+}
+print("version() =", version());
+
+// Test 11: For loops - counted loops over numbers run on the fast loop
+// engine, anything else in the interpreter
+print("\nTest 11: For loops");
+var total = 0;
+for (var i = 0; i < 10; i = i + 1) {
+    total = total + i;
+}
+print("sum 0..9 =", total, "i =", i);
+
+var evens = 0;
+for (var j = 10; j >= 0; j = j - 2) {
+    if (j % 4 == 0) {
+        evens = evens + j;
+    }
+}
+print("multiples of 4 =", evens, "j =", j);
+
+function sumTo(n) {
+    var s = 0;
+    for (var k = 1; k <= n; k = k + 1) {
+        s = s + k;
+    }
+    return s;
+}
+print("sumTo(100) =", sumTo(100), "sumTo(10) =", sumTo(10));
+
+// A string in a loop variable on entry keeps the loop in the interpreter
+var digits = "digits:";
+for (var d = 0; d < 4; d = d + 1) {
+    digits = digits + d;
+}
+print(digits);
+
+// The counter itself may hold anything before the loop sets it
+var counter = "unset";
+for (counter = 0; counter < 3; counter = counter + 1) {
+}
+print("counter =", counter);
+
+for (var m = 0; m < 2; m = m + 1) {
+    print("call in body, m =", m);
+}
+
+var n = 0;
+for (; n < 5;) {
+    n = n + 2;
+}
+print("n =", n);
+
 print("\n=== All tests completed ===");
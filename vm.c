@@ -0,0 +1,293 @@
+#include "minall.h"
+
+// Stack VM for programs produced by compile_program
+//
+// With MINALL_THREADED_DISPATCH every handler ends in its own indirect jump
+// through a per-opcode label table (GCC labels-as-values), so each opcode
+// gets its own branch-predictor history. Otherwise a portable switch loop
+// is used.
+
+static INLINE Value vm_binary_slow(OpCode op, Value left, Value right) {
+    if (op == OP_ADD && (value_is_string(left) || value_is_string(right))) {
+        return concat_values(left, right);
+    }
+    return value_undefined();
+}
+
+// Major collection with the stack and the globals as roots; every live
+// value is on one or the other between instructions
+static void vm_collect(Value* stack, Value* sp, Value* globals, int global_count) {
+    gc_begin(0, true);
+    for (Value* value = stack; value < sp; value++) {
+        gc_trace(value);
+    }
+    for (int i = 0; i < global_count; i++) {
+        gc_trace(&globals[i]);
+    }
+    gc_end();
+}
+
+// Runs on the stacks of the current isolate. The first script_arg_count
+// globals start out as script_args, the rest undefined; each run starts
+// afresh, so a program can run any number of times.
+Value vm_execute(BytecodeProgram* program, Value* script_args, int script_arg_count) {
+    Value* stack = minall_current->vm_stack;
+    CallFrame* frames = minall_current->vm_frames;
+    FILE* out = minall_current->out;
+    if (!program->globals) {
+        program->globals = (Value*)minall_malloc((program->global_count + 1) * sizeof(Value));
+    }
+    Value* globals = program->globals;
+    for (int i = 0; i < program->global_count; i++) {
+        globals[i] = i < script_arg_count ? script_args[i] : value_undefined();
+    }
+
+    BytecodeFunction* functions = program->functions;
+    String* strings = program->strings;
+
+    // OP_CALL checks each callee's room; the script itself is checked here
+    if (UNLIKELY(functions[0].local_count + functions[0].max_stack > VM_STACK_SIZE)) {
+        fprintf(stderr, "Maximum call stack size exceeded in %.*s\n",
+                (int)functions[0].name->length, functions[0].name->chars);
+        return value_undefined();
+    }
+
+    CallFrame* frame = frames;
+    frame->function = &functions[0];
+    frame->return_ip = NULL;
+    frame->slots = stack;
+
+    Value* sp = stack;
+    Value* slots = frame->slots;
+    Instruction* ip = frame->function->code;
+
+#define PUSH(v) (*sp++ = (v))
+#define POP()   (*--sp)
+#define PEEK()  (sp[-1])
+
+// Operates in place on the stack so the fast path only touches the doubles
+#define NUMERIC_BINARY(expr)                                                   \
+    do {                                                                       \
+        Value* right = --sp;                                                   \
+        Value* left = sp - 1;                                                  \
+        if (LIKELY(value_is_number(*left) && value_is_number(*right))) {       \
+            double l = value_as_number(*left);                                 \
+            double r = value_as_number(*right);                                \
+            *left = value_number(expr);                                        \
+        } else {                                                               \
+            *left = vm_binary_slow(ip->op, *left, *right);                     \
+            if (UNLIKELY(gc_due())) {                                          \
+                vm_collect(stack, sp, globals, program->global_count);         \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+
+#ifdef MINALL_THREADED_DISPATCH
+    static const void* dispatch_table[] = {
+        [OP_LOAD_NUMBER] = &&do_OP_LOAD_NUMBER,
+        [OP_LOAD_STRING] = &&do_OP_LOAD_STRING,
+        [OP_LOAD_UNDEFINED] = &&do_OP_LOAD_UNDEFINED,
+        [OP_LOAD_VAR] = &&do_OP_LOAD_VAR,
+        [OP_STORE_VAR] = &&do_OP_STORE_VAR,
+        [OP_LOAD_GLOBAL] = &&do_OP_LOAD_GLOBAL,
+        [OP_STORE_GLOBAL] = &&do_OP_STORE_GLOBAL,
+        [OP_DUP] = &&do_OP_DUP,
+        [OP_POP] = &&do_OP_POP,
+        [OP_ADD] = &&do_OP_ADD,
+        [OP_SUB] = &&do_OP_SUB,
+        [OP_MUL] = &&do_OP_MUL,
+        [OP_DIV] = &&do_OP_DIV,
+        [OP_MOD] = &&do_OP_MOD,
+        [OP_NEG] = &&do_OP_NEG,
+        [OP_NOT] = &&do_OP_NOT,
+        [OP_AND] = &&do_OP_AND,
+        [OP_OR] = &&do_OP_OR,
+        [OP_CMP_LT] = &&do_OP_CMP_LT,
+        [OP_CMP_LE] = &&do_OP_CMP_LE,
+        [OP_CMP_GT] = &&do_OP_CMP_GT,
+        [OP_CMP_GE] = &&do_OP_CMP_GE,
+        [OP_CMP_EQ] = &&do_OP_CMP_EQ,
+        [OP_CMP_NE] = &&do_OP_CMP_NE,
+        [OP_JUMP] = &&do_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&do_OP_JUMP_IF_FALSE,
+        [OP_CALL] = &&do_OP_CALL,
+        [OP_CALL_NATIVE] = &&do_OP_CALL_NATIVE,
+        [OP_PRINT] = &&do_OP_PRINT,
+        [OP_RETURN] = &&do_OP_RETURN,
+        [OP_HALT] = &&do_OP_HALT,
+    };
+
+#define VM_CASE(op) do_##op:
+#define VM_JUMP() goto *dispatch_table[ip->op]
+#define VM_DISPATCH() goto *dispatch_table[(++ip)->op]
+
+    VM_JUMP();
+#else
+#define VM_CASE(op) case op:
+#define VM_JUMP() continue
+#define VM_DISPATCH() ip++; continue
+
+    for (;;) {
+        switch (ip->op) {
+#endif
+            VM_CASE(OP_LOAD_NUMBER)
+                PUSH(value_number(ip->operand.number));
+                VM_DISPATCH();
+
+            VM_CASE(OP_LOAD_STRING)
+                // Strings are immutable, so the literal can be shared
+                PUSH(value_string(&strings[ip->operand.string_index]));
+                VM_DISPATCH();
+
+            VM_CASE(OP_LOAD_UNDEFINED)
+                PUSH(value_undefined());
+                VM_DISPATCH();
+
+            VM_CASE(OP_LOAD_VAR)
+                PUSH(slots[ip->operand.var_index]);
+                VM_DISPATCH();
+
+            VM_CASE(OP_STORE_VAR)
+                slots[ip->operand.var_index] = POP();
+                VM_DISPATCH();
+
+            VM_CASE(OP_LOAD_GLOBAL)
+                PUSH(globals[ip->operand.var_index]);
+                VM_DISPATCH();
+
+            VM_CASE(OP_STORE_GLOBAL)
+                globals[ip->operand.var_index] = POP();
+                VM_DISPATCH();
+
+            VM_CASE(OP_DUP)
+                sp[0] = sp[-1];
+                sp++;
+                VM_DISPATCH();
+
+            VM_CASE(OP_POP)
+                sp--;
+                VM_DISPATCH();
+
+            VM_CASE(OP_ADD) NUMERIC_BINARY(l + r); VM_DISPATCH();
+            VM_CASE(OP_SUB) NUMERIC_BINARY(l - r); VM_DISPATCH();
+            VM_CASE(OP_MUL) NUMERIC_BINARY(l * r); VM_DISPATCH();
+            VM_CASE(OP_DIV) NUMERIC_BINARY(LIKELY(r != 0) ? l / r : 0); VM_DISPATCH();
+            VM_CASE(OP_MOD) NUMERIC_BINARY(LIKELY(r != 0) ? (double)((int)l % (int)r) : 0); VM_DISPATCH();
+            VM_CASE(OP_AND) NUMERIC_BINARY(l != 0 && r != 0 ? 1 : 0); VM_DISPATCH();
+            VM_CASE(OP_OR)  NUMERIC_BINARY(l != 0 || r != 0 ? 1 : 0); VM_DISPATCH();
+            VM_CASE(OP_CMP_LT) NUMERIC_BINARY(l < r ? 1 : 0); VM_DISPATCH();
+            VM_CASE(OP_CMP_LE) NUMERIC_BINARY(l <= r ? 1 : 0); VM_DISPATCH();
+            VM_CASE(OP_CMP_GT) NUMERIC_BINARY(l > r ? 1 : 0); VM_DISPATCH();
+            VM_CASE(OP_CMP_GE) NUMERIC_BINARY(l >= r ? 1 : 0); VM_DISPATCH();
+            VM_CASE(OP_CMP_EQ) NUMERIC_BINARY(l == r ? 1 : 0); VM_DISPATCH();
+            VM_CASE(OP_CMP_NE) NUMERIC_BINARY(l != r ? 1 : 0); VM_DISPATCH();
+
+            VM_CASE(OP_NEG)
+                PEEK() = value_is_number(PEEK()) ? value_number(-value_as_number(PEEK()))
+                                                 : value_undefined();
+                VM_DISPATCH();
+
+            VM_CASE(OP_NOT)
+                PEEK() = value_number(is_truthy(PEEK()) ? 0 : 1);
+                VM_DISPATCH();
+
+            VM_CASE(OP_JUMP)
+                ip += ip->operand.jump_offset;
+                VM_DISPATCH();
+
+            VM_CASE(OP_JUMP_IF_FALSE)
+                if (!is_truthy(POP())) {
+                    ip += ip->operand.jump_offset;
+                }
+                VM_DISPATCH();
+
+            VM_CASE(OP_CALL) {
+                BytecodeFunction* callee = &functions[ip->operand.call.function_index];
+                int arg_count = ip->operand.call.arg_count;
+
+                if (UNLIKELY(frame + 1 >= frames + MAX_CALL_STACK ||
+                             sp - arg_count + callee->local_count + callee->max_stack >
+                                 stack + VM_STACK_SIZE)) {
+                    fprintf(stderr, "Maximum call stack size exceeded in %.*s\n",
+                            (int)callee->name->length, callee->name->chars);
+                    // Only this call fails, yielding undefined, as in the
+                    // tree walker
+                    sp -= arg_count;
+                    PUSH(value_undefined());
+                    VM_DISPATCH();
+                }
+
+                // Drop surplus arguments, then fill missing params and locals
+                if (arg_count > callee->param_count) {
+                    sp -= arg_count - callee->param_count;
+                    arg_count = callee->param_count;
+                }
+                Value* callee_slots = sp - arg_count;
+                while (sp < callee_slots + callee->local_count) {
+                    PUSH(value_undefined());
+                }
+
+                frame->return_ip = ip;
+                frame++;
+                frame->function = callee;
+                frame->slots = callee_slots;
+                slots = callee_slots;
+                ip = callee->code;
+                VM_JUMP();
+            }
+
+            VM_CASE(OP_CALL_NATIVE) {
+                Native* native = &minall_current->natives[ip->operand.call.function_index];
+                int arg_count = ip->operand.call.arg_count;
+                Value* args = sp - arg_count;
+                Value result = native->function(args, arg_count, native->data);
+                sp = args;
+                PUSH(result);
+                if (UNLIKELY(gc_due())) {
+                    vm_collect(stack, sp, globals, program->global_count);
+                }
+                VM_DISPATCH();
+            }
+
+            VM_CASE(OP_PRINT) {
+                int arg_count = ip->operand.call.arg_count;
+                Value* args = sp - arg_count;
+                for (int i = 0; i < arg_count; i++) {
+                    print_value(args[i]);
+                    if (i < arg_count - 1) fputc(' ', out);
+                }
+                fputc('\n', out);
+                sp = args;
+                PUSH(value_undefined());
+                VM_DISPATCH();
+            }
+
+            VM_CASE(OP_RETURN) {
+                Value value = POP();
+                if (frame == frames) {
+                    // `return` at the top level ends the script
+                    return value;
+                }
+                sp = frame->slots;
+                frame--;
+                slots = frame->slots;
+                ip = frame->return_ip;
+                PUSH(value);
+                VM_DISPATCH();
+            }
+
+            VM_CASE(OP_HALT)
+                return value_undefined();
+#ifndef MINALL_THREADED_DISPATCH
+        }
+    }
+#endif
+
+#undef VM_DISPATCH
+#undef VM_JUMP
+#undef VM_CASE
+#undef NUMERIC_BINARY
+#undef PEEK
+#undef POP
+#undef PUSH
+}
@@ -0,0 +1,7 @@
+// The VM again, built with the portable switch loop as vm_execute_switch,
+// so run_performance_tests can time both dispatch modes in one binary
+#ifndef MINALL_SWITCH_DISPATCH
+#define MINALL_SWITCH_DISPATCH
+#endif
+#define vm_execute vm_execute_switch
+#include "vm.c"